@@ -0,0 +1,117 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "contact-sheet.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <string>
+
+#include "event-loop.h"
+#include "image-display.h"
+#include "terminal-canvas.h"
+#include "thread-pool.h"
+
+namespace timg {
+// Horizontal space between thumbnails in pixels, i.e. characters.
+static constexpr int kColumnGap = 2;
+
+typedef std::unique_ptr<Framebuffer> Thumbnail;
+
+// Filename fitting in "width" characters, padded with spaces.
+static std::string FitTitle(const char *filename, int width) {
+    std::string title(filename);
+    if ((int)title.size() > width && width > 2) {
+        title = title.substr(title.size() - width + 2);  // Keep the end.
+        title = ".." + title;
+    }
+    title.resize(width, ' ');
+    return title;
+}
+
+bool ShowContactSheet(const std::vector<const char *> &files,
+                      int columns, int rows,
+                      int display_width, int display_height,
+                      const DisplayOptions &display_options,
+                      const char *bg_color, const char *pattern_color,
+                      ThreadPool *pool, EventLoop *event_loop,
+                      TerminalCanvas *canvas) {
+    if (columns < 1) columns = 1;
+    const int cell_width = std::max(1, display_width / columns);
+    int cell_height = cell_width;
+    if (rows > 0) {
+        // Each row also needs one line of text, i.e. two pixels.
+        cell_height = std::max(1, display_height / rows - 2);
+    }
+    const int thumb_width = std::max(1, cell_width - kColumnGap);
+
+    DisplayOptions options = display_options;
+    options.fill_width = options.fill_height = false;
+    options.center_horizontally = false;
+
+    // Queue up all the work; the pool works through it in order, so the
+    // first rows are ready first.
+    std::vector<std::future<Thumbnail>> thumbnails;
+    for (const char *filename : files) {
+        thumbnails.push_back(pool->ExecAsync([=]() {
+                    // Only the small thumbnail is held on to while
+                    // waiting for the rest of the row.
+                    return LoadFirstFrame(filename, thumb_width, cell_height,
+                                          options, bg_color, pattern_color);
+                }));
+    }
+
+    bool all_success = true;
+    for (size_t row_start = 0;
+         row_start < files.size() && !event_loop->interrupted();
+         row_start += columns) {
+        const size_t row_end = std::min(row_start + columns, files.size());
+        std::vector<Thumbnail> row;
+        int row_height = 1;
+        for (size_t i = row_start; i < row_end; ++i) {
+            row.push_back(thumbnails[i].get());
+            if (row.back()) {
+                row_height = std::max(row_height, row.back()->height());
+            } else {
+                all_success = false;
+            }
+        }
+
+        // Compose the row, each thumbnail centered in its cell.
+        Framebuffer composed(cell_width * (row_end - row_start), row_height);
+        std::string titles;
+        for (size_t col = 0; col < row.size(); ++col) {
+            titles.append(FitTitle(files[row_start + col], cell_width));
+            const Framebuffer *thumb = row[col].get();
+            if (!thumb) continue;
+            const int x_offset = col * cell_width
+                + (thumb_width - thumb->width()) / 2;
+            const int y_offset = (row_height - thumb->height()) / 2;
+            for (int y = 0; y < thumb->height(); ++y) {
+                std::copy(thumb->row(y), thumb->row(y) + thumb->width(),
+                          composed.row(y + y_offset) + x_offset);
+            }
+        }
+        canvas->Send(composed, 0);
+        titles.append("\n");
+        canvas->SendEncoded(titles.data(), titles.size());
+    }
+    return all_success;
+}
+}  // namespace timg
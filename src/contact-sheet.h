@@ -0,0 +1,44 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef CONTACT_SHEET_H_
+#define CONTACT_SHEET_H_
+
+#include <vector>
+
+namespace timg {
+struct DisplayOptions;
+class EventLoop;
+class TerminalCanvas;
+class ThreadPool;
+
+// Show "files" as a contact sheet: thumbnails in a grid with "columns"
+// columns across "display_width", each with its filename underneath.
+// If "rows" is positive, thumbnails are sized so that that many rows fit
+// in "display_height", otherwise thumbnail cells are square.
+// Images are decoded and scaled on the "pool"; each row of thumbnails is
+// composed into one framebuffer and sent at once as soon as it is ready.
+// "bg_color" and "pattern_color" as in ImageLoader::LoadAndScale().
+// Returns false if any of the files could not be loaded.
+bool ShowContactSheet(const std::vector<const char *> &files,
+                      int columns, int rows,
+                      int display_width, int display_height,
+                      const DisplayOptions &options,
+                      const char *bg_color, const char *pattern_color,
+                      ThreadPool *pool, EventLoop *event_loop,
+                      TerminalCanvas *canvas);
+}  // namespace timg
+
+#endif  // CONTACT_SHEET_H_
@@ -0,0 +1,338 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "event-loop.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace timg {
+EventLoop::EventLoop() {}
+
+EventLoop::~EventLoop() {
+    if (keyboard_fd_ >= 0) {
+        tcsetattr(keyboard_fd_, TCSANOW, &saved_termios_);
+    }
+    if (signal_fd_ >= 0) close(signal_fd_);
+    if (wakeup_fd_ >= 0) close(wakeup_fd_);
+    if (timer_fd_ >= 0) close(timer_fd_);
+    if (epoll_fd_ >= 0) close(epoll_fd_);
+}
+
+static bool WatchFd(int epoll_fd, int fd) {
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+bool EventLoop::Init(int keyboard_fd) {
+    // Block the signals we're interested in, so that they are only reported
+    // through the signalfd. Threads created later inherit that mask.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGWINCH);
+    if (sigprocmask(SIG_BLOCK, &mask, nullptr) != 0) return false;
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    signal_fd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd_ < 0 || signal_fd_ < 0 || timer_fd_ < 0 || wakeup_fd_ < 0) {
+        perror("Setting up event loop");
+        return false;
+    }
+    if (!WatchFd(epoll_fd_, signal_fd_) || !WatchFd(epoll_fd_, timer_fd_) ||
+        !WatchFd(epoll_fd_, wakeup_fd_)) {
+        return false;
+    }
+
+    // Keyboard: character-by-character without echo. We don't switch the
+    // file descriptor to O_NONBLOCK as it typically shares the open file
+    // with stdout; we only read() after epoll() told us there is something.
+    if (keyboard_fd >= 0 && isatty(keyboard_fd)
+        && tcgetattr(keyboard_fd, &saved_termios_) == 0) {
+        struct termios raw = saved_termios_;
+        raw.c_lflag &= ~(ICANON | ECHO);   // Keep ISIG: Ctrl-C still works.
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        if (tcsetattr(keyboard_fd, TCSANOW, &raw) == 0) {
+            keyboard_fd_ = keyboard_fd;
+            if (!WatchFd(epoll_fd_, keyboard_fd_)) {
+                tcsetattr(keyboard_fd_, TCSANOW, &saved_termios_);
+                keyboard_fd_ = -1;
+            }
+        }
+    }
+    return true;
+}
+
+bool EventLoop::WatchInput(int fd) {
+    return WatchFd(epoll_fd_, fd);
+}
+
+void EventLoop::UnwatchInput(int fd) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    pending_inputs_.erase(std::remove(pending_inputs_.begin(),
+                                      pending_inputs_.end(), fd),
+                          pending_inputs_.end());
+}
+
+bool EventLoop::TrackTerminalSize(int fd) {
+    terminal_fd_ = fd;
+    if (!UpdateTerminalSize()) {
+        terminal_fd_ = -1;
+        return false;
+    }
+    return true;
+}
+
+bool EventLoop::UpdateTerminalSize() {
+    struct winsize w = {};
+    if (ioctl(terminal_fd_, TIOCGWINSZ, &w) != 0 || w.ws_col == 0)
+        return false;
+    const int width = w.ws_col;
+    const int height = 2 * (w.ws_row - 1);  // double number of pixels high.
+    if (width == terminal_width_ && height == terminal_height_)
+        return false;
+    terminal_width_ = width;
+    terminal_height_ = height;
+    return true;
+}
+
+void EventLoop::ReadSignals() {
+    struct signalfd_siginfo info;
+    while (read(signal_fd_, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGWINCH) {
+            if (terminal_fd_ >= 0 && UpdateTerminalSize())
+                resize_pending_ = true;
+        } else {
+            interrupted_ = true;
+        }
+    }
+}
+
+void EventLoop::ReadKeys() {
+    char buf[64];
+    const ssize_t len = read(keyboard_fd_, buf, sizeof(buf));
+    if (len <= 0) {
+        if (len < 0 && errno == EINTR) return;
+        // Terminal went away. Continue without keyboard.
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, keyboard_fd_, nullptr);
+        keyboard_fd_ = -1;
+        return;
+    }
+    // Decode the typical VT100/xterm escape sequences for special keys. A
+    // lone escape is reported as such.
+    for (ssize_t i = 0; i < len; ++i) {
+        if (buf[i] != 0x1b || i + 2 >= len || buf[i+1] != '[') {
+            pending_keys_.push_back((unsigned char)buf[i]);
+            continue;
+        }
+        i += 2;
+        int key = kKeyNone;
+        switch (buf[i]) {
+        case 'A': key = kKeyUp; break;
+        case 'B': key = kKeyDown; break;
+        case 'C': key = kKeyRight; break;
+        case 'D': key = kKeyLeft; break;
+        case 'H': key = kKeyHome; break;
+        case 'F': key = kKeyEnd; break;
+        case '1': key = kKeyHome; break;
+        case '4': key = kKeyEnd; break;
+        case '5': key = kKeyPageUp; break;
+        case '6': key = kKeyPageDown; break;
+        }
+        // Numbered sequences are terminated by a tilde.
+        if (buf[i] >= '0' && buf[i] <= '9') {
+            while (i < len && buf[i] != '~') ++i;
+        }
+        if (key != kKeyNone) pending_keys_.push_back(key);
+    }
+}
+
+void EventLoop::Wakeup() {
+    const uint64_t one = 1;
+    if (write(wakeup_fd_, &one, sizeof(one)) < 0) {
+        // Counter saturated: plenty of wakeups pending already.
+    }
+}
+
+EventLoop::Event EventLoop::WaitUntil(const Time &deadline) {
+    if (interrupted_) return Event::kInterrupt;
+    if (!pending_keys_.empty()) {
+        last_key_ = pending_keys_.front();
+        pending_keys_.pop_front();
+        return Event::kKey;
+    }
+    if (!pending_inputs_.empty()) {
+        input_fd_ = pending_inputs_.front();
+        pending_inputs_.pop_front();
+        return Event::kInput;
+    }
+
+    // A deadline in the past will fire right away.
+    struct itimerspec timer = {};
+    timer.it_value = deadline.time();
+    timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &timer, nullptr);
+
+    for (;;) {
+        struct epoll_event events[8];
+        const int n = epoll_wait(epoll_fd_, events, 8, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait()");
+            deadline.WaitUntil();  // Best we can do.
+            return Event::kDeadline;
+        }
+        bool deadline_reached = false;
+        bool woken_up = false;
+        for (int i = 0; i < n; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == signal_fd_) {
+                ReadSignals();
+            } else if (fd == timer_fd_) {
+                uint64_t expirations;
+                if (read(timer_fd_, &expirations, sizeof(expirations)) > 0)
+                    deadline_reached = true;
+            } else if (fd == wakeup_fd_) {
+                uint64_t count;
+                if (read(wakeup_fd_, &count, sizeof(count)) > 0)
+                    woken_up = true;
+            } else if (fd == keyboard_fd_) {
+                ReadKeys();
+            } else if (std::find(pending_inputs_.begin(), pending_inputs_.end(),
+                                 fd) == pending_inputs_.end()) {
+                pending_inputs_.push_back(fd);
+            }
+        }
+
+        if (interrupted_) return Event::kInterrupt;
+        if (resize_pending_) {
+            resize_pending_ = false;
+            return Event::kResize;
+        }
+        if (!pending_keys_.empty()) {
+            last_key_ = pending_keys_.front();
+            pending_keys_.pop_front();
+            return Event::kKey;
+        }
+        // Inputs stay readable until read; don't let them starve timing.
+        if (deadline_reached) return Event::kDeadline;
+        if (!pending_inputs_.empty()) {
+            input_fd_ = pending_inputs_.front();
+            pending_inputs_.pop_front();
+            return Event::kInput;
+        }
+        if (woken_up) return Event::kWakeup;
+    }
+}
+
+EventLoop::Command EventLoop::WaitForNextFrame(const Time &deadline) {
+    std::vector<int> deferred_inputs;
+    const Command command = WaitForFrameCommand(deadline, &deferred_inputs);
+    for (int fd : deferred_inputs) {
+        WatchInput(fd);  // Level-triggered: reported again if still readable.
+    }
+    return command;
+}
+
+EventLoop::Event EventLoop::WaitBetweenImages(const Time &deadline) {
+    std::vector<int> deferred_inputs;
+    Event event;
+    for (;;) {
+        event = WaitUntil(deadline);
+        if (event == Event::kKey && key() == 'q') {
+            interrupted_ = true;
+            event = Event::kInterrupt;
+        }
+        if (event == Event::kInput) {
+            // Not ours to read; see WaitForFrameCommand().
+            UnwatchInput(input_fd());
+            deferred_inputs.push_back(input_fd());
+            continue;
+        }
+        if (event == Event::kDeadline || event == Event::kInterrupt
+            || event == Event::kResize) {
+            break;
+        }
+    }
+    for (int fd : deferred_inputs) {
+        WatchInput(fd);
+    }
+    return event;
+}
+
+EventLoop::Command EventLoop::WaitForFrameCommand(
+    const Time &deadline, std::vector<int> *deferred_inputs) {
+    for (;;) {
+        const Time wait_until = paused_
+            ? Time::Now() + Duration::InfiniteFuture()
+            : deadline;
+        switch (WaitUntil(wait_until)) {
+        case Event::kDeadline:  return Command::kNextFrame;
+        case Event::kInterrupt: return Command::kQuit;
+        case Event::kResize:    return Command::kResize;
+        case Event::kKey:       break;
+        case Event::kWakeup:    continue;
+        case Event::kInput:
+            // Stays readable until the owner reads it, which is not us;
+            // don't spin on it.
+            UnwatchInput(input_fd());
+            deferred_inputs->push_back(input_fd());
+            continue;
+        }
+
+        switch (key()) {
+        case ' ':
+            paused_ = !paused_;
+            if (!paused_) return Command::kResume;
+            break;
+        case '.':
+            paused_ = true;
+            return Command::kNextFrame;
+        case ',':
+            paused_ = true;
+            return Command::kStepBackward;
+        case kKeyRight:
+            return Command::kSeekForward;
+        case kKeyLeft:
+            return Command::kSeekBackward;
+        case 'q':
+            interrupted_ = true;
+            return Command::kQuit;
+        default:
+            if (std::find(exit_keys_.begin(), exit_keys_.end(), key())
+                != exit_keys_.end()) {
+                paused_ = false;
+                exit_key_ = key();
+                return Command::kExitKey;
+            }
+        }
+    }
+}
+}  // namespace timg
@@ -0,0 +1,187 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+
+#include <termios.h>
+
+#include <deque>
+#include <vector>
+
+#include "timg-time.h"
+
+namespace timg {
+// The one place where timg waits: for the deadline of the next frame, for
+// signals and for keyboard input.
+// Built on epoll() watching a timerfd armed with the next deadline, a
+// signalfd for SIGINT, SIGTERM and SIGWINCH and, if interactive, the
+// terminal input. Nothing is busy-polled, but everything is noticed as soon
+// as it happens.
+class EventLoop {
+public:
+    // Keys as reported by key(). Regular characters are reported as-is,
+    // special keys get values outside the character range.
+    enum Key {
+        kKeyNone = 0,
+        kKeyEscape = 0x1b,
+        kKeyUp = 0x100,
+        kKeyDown,
+        kKeyRight,
+        kKeyLeft,
+        kKeyPageUp,
+        kKeyPageDown,
+        kKeyHome,
+        kKeyEnd,
+    };
+
+    enum class Event {
+        kDeadline,      // The requested deadline has been reached.
+        kInterrupt,     // SIGINT/SIGTERM received or user requested to quit.
+        kResize,        // Terminal changed its size.
+        kKey,           // A key has been pressed; see key().
+        kWakeup,        // Wakeup() has been called.
+        kInput,         // A file descriptor given to WatchInput() is
+                        // readable; see input_fd().
+    };
+
+    // What the user wants playback of animations, videos or scrolling to do.
+    enum class Command {
+        kNextFrame,     // Time for the next frame, or single step forward.
+        kResume,        // Resumed after pause; timing needs to be re-synced.
+        kStepBackward,  // Show previous frame (playback is paused).
+        kSeekForward,   // Skip a chunk forward.
+        kSeekBackward,  // Skip a chunk backward.
+        kResize,        // Terminal has been resized.
+        kExitKey,       // One of the exit keys was pressed; stop playing.
+        kQuit,          // Stop playing.
+    };
+
+    EventLoop();
+    ~EventLoop();
+
+    // Set up the loop. From now on, SIGINT, SIGTERM and SIGWINCH are only
+    // delivered through this loop.
+    // If "keyboard_fd" is a terminal, it is switched to non-canonical mode
+    // without echo and key presses are reported. Otherwise (or if -1), there
+    // is no keyboard input.
+    // Returns false if the loop could not be set up.
+    bool Init(int keyboard_fd);
+
+    // Follow the size of the terminal on "fd". Only then, terminal resizes
+    // are reported as Event::kResize.
+    // Returns false if "fd" is not a terminal.
+    bool TrackTerminalSize(int fd);
+
+    // Current size of the tracked terminal in pixels: each character cell
+    // is one pixel wide and two pixels high. The last line is kept free
+    // for the cursor.
+    int terminal_pixel_width() const { return terminal_width_; }
+    int terminal_pixel_height() const { return terminal_height_; }
+
+    // Wait until "deadline" is reached or any other event occurs.
+    Event WaitUntil(const Time &deadline);
+
+    // Make a WaitUntil() in progress (or the next one) return with
+    // Event::kWakeup. Can be called from any thread, e.g. to announce that
+    // new content is ready to be shown.
+    void Wakeup();
+
+    // Also wait for "fd" to become readable, reported as Event::kInput.
+    // The caller has to read what is available before waiting again.
+    bool WatchInput(int fd);
+
+    // Stop watching "fd" given to WatchInput() before.
+    void UnwatchInput(int fd);
+
+    // File descriptor that became readable with the last Event::kInput.
+    int input_fd() const { return input_fd_; }
+
+    // Key read with the last Event::kKey.
+    int key() const { return last_key_; }
+
+    // Returns true once an interrupt signal has been received or the user
+    // pressed the quit key. Sticky.
+    bool interrupted() const { return interrupted_; }
+
+    bool interactive() const { return keyboard_fd_ >= 0; }
+
+    // Wait for the "deadline" of the next frame in playback, handling keys on
+    // the way: <space> toggles pause, '.' and ',' step forward and backward,
+    // cursor right/left seek and 'q' quits. While paused, the deadline is
+    // ignored.
+    // Inputs given to WatchInput() that become readable in the meantime are
+    // not watched until this returns; the next WaitUntil() reports them.
+    Command WaitForNextFrame(const Time &deadline);
+
+    bool paused() const { return paused_; }
+
+    // Call when playback of a new animation, video or document starts: it
+    // is not paused, even if stepping left the previous one paused.
+    void StartPlayback() { paused_ = false; }
+
+    // Wait while an image is shown until "deadline" or until the user quits
+    // with 'q' (or an interrupt signal), which is reported as
+    // Event::kInterrupt. Other keys are ignored. Returns Event::kResize on
+    // terminal resize, to be called again after re-layout; otherwise
+    // Event::kDeadline.
+    Event WaitBetweenImages(const Time &deadline);
+
+    // Keys that are not handled by WaitForNextFrame() itself but end
+    // playback with Command::kExitKey, e.g. to navigate to another image.
+    // The key is remembered to be picked up with TakeExitKey().
+    void SetExitKeys(const std::vector<int> &keys) { exit_keys_ = keys; }
+
+    // Return exit key that ended playback and forget about it. Returns
+    // kKeyNone if there was none.
+    int TakeExitKey() {
+        const int key = exit_key_;
+        exit_key_ = kKeyNone;
+        return key;
+    }
+
+private:
+    void ReadSignals();
+    void ReadKeys();
+    bool UpdateTerminalSize();
+
+    // WaitForNextFrame(), with readable inputs taken out of the watched
+    // set and appended to "deferred_inputs".
+    Command WaitForFrameCommand(const Time &deadline,
+                                std::vector<int> *deferred_inputs);
+
+    int epoll_fd_ = -1;
+    int timer_fd_ = -1;
+    int signal_fd_ = -1;
+    int wakeup_fd_ = -1;
+    int keyboard_fd_ = -1;
+    struct termios saved_termios_;
+    int terminal_fd_ = -1;     // Terminal we track the size of.
+    int terminal_width_ = -1;
+    int terminal_height_ = -1;
+
+    std::deque<int> pending_keys_;
+    int last_key_ = kKeyNone;
+    std::deque<int> pending_inputs_;
+    int input_fd_ = -1;
+    bool interrupted_ = false;
+    bool resize_pending_ = false;
+    bool paused_ = false;
+    std::vector<int> exit_keys_;
+    int exit_key_ = kKeyNone;
+};
+}  // namespace timg
+
+#endif  // EVENT_LOOP_H_
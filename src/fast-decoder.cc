@@ -0,0 +1,296 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "fast-decoder.h"
+
+#include "file-content.h"
+#include "framebuffer-scaler.h"
+
+#ifdef WITH_TIMG_FAST_DECODERS
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <jpeglib.h>
+#include <png.h>
+#include <webp/decode.h>
+
+namespace timg {
+// Larger images are left to Magick, which scales them down while decoding.
+static constexpr int64_t kMaxPixels = 32 << 20;
+
+// Smaller JPEGs are decoded quickly enough to not need a preview.
+static constexpr int64_t kPreviewMinPixels = 4 << 20;
+
+static bool IsJPEG(const uint8_t *data, size_t size) {
+    return size > 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+}
+
+static bool IsPNG(const uint8_t *data, size_t size) {
+    static constexpr uint8_t kSignature[] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    return size > sizeof(kSignature)
+        && memcmp(data, kSignature, sizeof(kSignature)) == 0;
+}
+
+static bool IsWebP(const uint8_t *data, size_t size) {
+    return size > 12 && memcmp(data, "RIFF", 4) == 0
+        && memcmp(data + 8, "WEBP", 4) == 0;
+}
+
+// libjpeg calls error_exit() on errors and expects it not to return.
+struct JPEGErrorManager {
+    struct jpeg_error_mgr manager;
+    jmp_buf on_error;
+};
+
+static void JPEGErrorExit(j_common_ptr cinfo) {
+    longjmp(reinterpret_cast<JPEGErrorManager*>(cinfo->err)->on_error, 1);
+}
+
+static void JPEGNoMessage(j_common_ptr) {}  // Warnings on corrupt data.
+
+// The IDCT can directly produce 1/2, 1/4 or 1/8 of the size. Choose the
+// smallest that is still at least the size ScaleToFit() asks for.
+static void ChooseDCTScale(int display_width, int display_height,
+                           const DisplayOptions &options,
+                           j_decompress_ptr cinfo) {
+    int target_width, target_height;
+    ScaleToFit(cinfo->image_width, cinfo->image_height,
+               display_width, display_height, options,
+               &target_width, &target_height);
+    for (int denom = 8; denom > 1; denom /= 2) {
+        const int width = (cinfo->image_width + denom - 1) / denom;
+        const int height = (cinfo->image_height + denom - 1) / denom;
+        if (width >= target_width && height >= target_height) {
+            cinfo->scale_num = 1;
+            cinfo->scale_denom = denom;
+            return;
+        }
+    }
+}
+
+// Read the output scanlines of a started decompression into a new
+// framebuffer, stored in "result" before it is filled, so that it can be
+// freed if decoding fails halfway.
+static void ReadJPEGRows(j_decompress_ptr cinfo, Framebuffer **result) {
+    *result = new Framebuffer(cinfo->output_width, cinfo->output_height);
+    JSAMPARRAY scanline = (*cinfo->mem->alloc_sarray)(
+        reinterpret_cast<j_common_ptr>(cinfo), JPOOL_IMAGE,
+        cinfo->output_width * cinfo->output_components, 1);
+    while (cinfo->output_scanline < cinfo->output_height) {
+        const int y = cinfo->output_scanline;
+        jpeg_read_scanlines(cinfo, scanline, 1);
+        const JSAMPLE *rgb = scanline[0];
+        Framebuffer::rgb_t *out = (*result)->row(y);
+        for (int x = 0; x < (int)cinfo->output_width; ++x, rgb += 3) {
+            out[x] = rgb[0] << 16 | rgb[1] << 8 | rgb[2];
+        }
+    }
+}
+
+static Framebuffer *DecodeJPEG(const FileContent &content,
+                               int display_width, int display_height,
+                               const DisplayOptions &options) {
+    struct jpeg_decompress_struct cinfo;
+    JPEGErrorManager error;
+    cinfo.err = jpeg_std_error(&error.manager);
+    error.manager.error_exit = JPEGErrorExit;
+    error.manager.output_message = JPEGNoMessage;
+    Framebuffer *volatile result = nullptr;
+    if (setjmp(error.on_error)) {
+        // Unsupported color space (e.g. CMYK), corrupt file, ...
+        delete result;
+        jpeg_destroy_decompress(&cinfo);
+        return nullptr;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(content.data()),
+                 content.size());
+    jpeg_read_header(&cinfo, TRUE);
+    ChooseDCTScale(display_width, display_height, options, &cinfo);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_calc_output_dimensions(&cinfo);
+    if ((int64_t)cinfo.output_width * cinfo.output_height > kMaxPixels) {
+        jpeg_destroy_decompress(&cinfo);
+        return nullptr;
+    }
+
+    jpeg_start_decompress(&cinfo);
+    ReadJPEGRows(&cinfo, const_cast<Framebuffer**>(&result));
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return result;
+}
+
+// Rows of the framebuffer have exactly the layout of 8-bit BGRA rows, so
+// decoders write right into it; then pixels are converted in place.
+static void ConvertBGRA(Framebuffer *framebuffer) {
+    Framebuffer::rgb_t *pixel = framebuffer->row(0);
+    Framebuffer::rgb_t *const end
+        = pixel + framebuffer->width() * framebuffer->height();
+    for (/**/; pixel < end; ++pixel) {
+        const uint8_t *bgra = reinterpret_cast<const uint8_t*>(pixel);
+        const uint8_t b = bgra[0], g = bgra[1], r = bgra[2], a = bgra[3];
+        *pixel = (a == 0) ? 0 : (r << 16 | g << 8 | b);  // 0: transparent.
+    }
+}
+
+static Framebuffer *DecodePNG(const FileContent &content,
+                              bool allow_transparency) {
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_memory(&image, content.data(),
+                                          content.size())) {
+        return nullptr;
+    }
+    if (((image.format & PNG_FORMAT_FLAG_ALPHA) && !allow_transparency)
+        || (int64_t)image.width * image.height > kMaxPixels) {
+        png_image_free(&image);
+        return nullptr;
+    }
+
+    image.format = PNG_FORMAT_BGRA;
+    Framebuffer *result = new Framebuffer(image.width, image.height);
+    if (!png_image_finish_read(&image, nullptr, result->row(0), 0, nullptr)) {
+        png_image_free(&image);
+        delete result;
+        return nullptr;
+    }
+    ConvertBGRA(result);
+    return result;
+}
+
+static Framebuffer *DecodeWebP(const FileContent &content,
+                               bool allow_transparency) {
+    WebPBitstreamFeatures features;
+    if (WebPGetFeatures(content.data(), content.size(), &features)
+        != VP8_STATUS_OK) {
+        return nullptr;
+    }
+    // Animations are left to Magick, which knows how to play them.
+    if (features.has_animation || (features.has_alpha && !allow_transparency)
+        || (int64_t)features.width * features.height > kMaxPixels) {
+        return nullptr;
+    }
+
+    // Same as with PNG: decoded as BGRA rows right into the framebuffer.
+    Framebuffer *result = new Framebuffer(features.width, features.height);
+    const int stride = features.width * sizeof(Framebuffer::rgb_t);
+    if (!WebPDecodeBGRAInto(content.data(), content.size(),
+                            reinterpret_cast<uint8_t*>(result->row(0)),
+                            (size_t)stride * features.height, stride)) {
+        delete result;
+        return nullptr;
+    }
+    ConvertBGRA(result);
+    return result;
+}
+
+Framebuffer *DecodeFast(const FileContent &content,
+                        int display_width, int display_height,
+                        const DisplayOptions &options,
+                        bool allow_transparency) {
+    if (IsJPEG(content.data(), content.size())) {
+        return DecodeJPEG(content, display_width, display_height, options);
+    }
+    if (IsPNG(content.data(), content.size())) {
+        return DecodePNG(content, allow_transparency);
+    }
+    if (IsWebP(content.data(), content.size())) {
+        return DecodeWebP(content, allow_transparency);
+    }
+    return nullptr;
+}
+
+Framebuffer *DecodePreview(const FileContent &content,
+                           int display_width, int display_height,
+                           const DisplayOptions &options) {
+    if (!IsJPEG(content.data(), content.size())) return nullptr;
+    struct jpeg_decompress_struct cinfo;
+    JPEGErrorManager error;
+    cinfo.err = jpeg_std_error(&error.manager);
+    error.manager.error_exit = JPEGErrorExit;
+    error.manager.output_message = JPEGNoMessage;
+    Framebuffer *volatile coarse = nullptr;
+    if (setjmp(error.on_error)) {
+        delete coarse;
+        jpeg_destroy_decompress(&cinfo);
+        return nullptr;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(content.data()),
+                 content.size());
+    jpeg_read_header(&cinfo, TRUE);
+
+    // The size DecodeJPEG() is going to decode at; only if that is a lot
+    // more work than the preview, it is worth showing one.
+    ChooseDCTScale(display_width, display_height, options, &cinfo);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_calc_output_dimensions(&cinfo);
+    const int full_width = cinfo.output_width;
+    const int full_height = cinfo.output_height;
+    const int64_t pixels = (int64_t)cinfo.image_width * cinfo.image_height;
+    if (cinfo.scale_denom > 2 || pixels < kPreviewMinPixels) {
+        jpeg_destroy_decompress(&cinfo);
+        return nullptr;
+    }
+
+    // Only DC coefficients, as cheap as it gets.
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 8;
+    cinfo.dct_method = JDCT_IFAST;
+    cinfo.do_fancy_upsampling = FALSE;
+    cinfo.do_block_smoothing = FALSE;
+
+    // Of a progressive JPEG, only the first scan is decoded. The content is
+    // in memory already, so this saves decode time, not reading.
+    cinfo.buffered_image = jpeg_has_multiple_scans(&cinfo);
+    jpeg_start_decompress(&cinfo);
+    if (cinfo.buffered_image) jpeg_start_output(&cinfo, 1);
+    ReadJPEGRows(&cinfo, const_cast<Framebuffer**>(&coarse));
+    jpeg_destroy_decompress(&cinfo);  // No need to finish.
+
+    // Same size as what the ImageLoader makes of the full decode.
+    int target_width, target_height;
+    ScaleToFit(full_width, full_height, display_width, display_height,
+               options, &target_width, &target_height);
+    Framebuffer *result = new Framebuffer(target_width, target_height);
+    FramebufferScaler(coarse->width(), coarse->height(),
+                      target_width, target_height).Scale(*coarse, result);
+    delete coarse;
+    return result;
+}
+}  // namespace timg
+
+#else  // WITH_TIMG_FAST_DECODERS
+
+namespace timg {
+Framebuffer *DecodeFast(const FileContent &content,
+                        int display_width, int display_height,
+                        const DisplayOptions &options,
+                        bool allow_transparency) {
+    return nullptr;
+}
+
+Framebuffer *DecodePreview(const FileContent &content,
+                           int display_width, int display_height,
+                           const DisplayOptions &options) {
+    return nullptr;
+}
+}  // namespace timg
+#endif  // WITH_TIMG_FAST_DECODERS
@@ -0,0 +1,57 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef FAST_DECODER_H_
+#define FAST_DECODER_H_
+
+#include "image-display.h"
+#include "terminal-canvas.h"
+
+namespace timg {
+class FileContent;
+
+// Decode plain JPEG, PNG and WebP images with libjpeg, libpng and libwebp
+// straight into a framebuffer, without going through Magick's pixel
+// representation.
+// JPEGs are decoded at a reduced size right from the DCT coefficients, as
+// long as the result is not smaller than what ScaleToFit() makes of the
+// image for "display_width" x "display_height" and "options".
+// Images with transparency are only decoded if "allow_transparency" is
+// set; fully transparent pixels are left black, as CopyToFramebuffer()
+// does.
+//
+// Returns nullptr if this is not an image decoded here (other formats,
+// CMYK JPEGs, huge PNGs, animated WebPs, ...) or if decoding fails; then
+// it should be read with Magick. Without the libraries compiled in, always
+// nullptr.
+Framebuffer *DecodeFast(const FileContent &content,
+                        int display_width, int display_height,
+                        const DisplayOptions &options,
+                        bool allow_transparency);
+
+// A coarse version of a large JPEG to show while the image is loaded,
+// decoded from the DC coefficients only (or just the first scan of a
+// progressive JPEG), which takes a few milliseconds instead of the time a
+// full decode takes; the whole file has to be read either way. It has the
+// size the ImageLoader is going to show the image in, so it can usually be
+// replaced by sending the difference.
+// Returns nullptr if there is no need for a preview, e.g. the image is
+// small enough to be decoded quickly or is no JPEG.
+Framebuffer *DecodePreview(const FileContent &content,
+                           int display_width, int display_height,
+                           const DisplayOptions &options);
+}  // namespace timg
+
+#endif  // FAST_DECODER_H_
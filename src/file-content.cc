@@ -0,0 +1,139 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "file-content.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <mutex>
+
+namespace timg {
+// Files up to this size are read instead of mapped. A mapped file that is
+// truncated while we decode it, such as an image rewritten in place while
+// we watch it, would kill us with SIGBUS.
+static constexpr off_t kMaxReadSize = 64 << 20;
+
+static std::mutex stdin_mutex;
+static std::shared_ptr<const FileContent> stdin_content;
+
+FileContent::~FileContent() {
+    if (mapped_) munmap((void*)data_, size_);
+}
+
+bool FileContent::IsStdin(const char *filename) {
+    return strcmp(filename, "-") == 0 || strcmp(filename, "/dev/stdin") == 0;
+}
+
+std::shared_ptr<const FileContent> FileContent::FromBuffer(
+    std::vector<uint8_t> *buffer) {
+    std::shared_ptr<FileContent> result(new FileContent());
+    result->buffer_.swap(*buffer);
+    result->data_ = result->buffer_.data();
+    result->size_ = result->buffer_.size();
+    return result;
+}
+
+std::shared_ptr<const FileContent> FileContent::ReadAll(int fd,
+                                                       size_t size_hint) {
+    std::shared_ptr<FileContent> result(new FileContent());
+    std::vector<uint8_t> &buffer = result->buffer_;
+    // One more than expected, so that end of file is seen without growing.
+    if (size_hint > 0) buffer.resize(size_hint + 1);
+    size_t size = 0;
+    for (;;) {
+        if (size == buffer.size()
+            || (size_hint == 0 && buffer.size() - size < 65536)) {
+            buffer.resize(std::max((size_t)65536 * 4, 2 * buffer.size()));
+        }
+        const ssize_t r = read(fd, buffer.data() + size, buffer.size() - size);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return nullptr;
+        if (r == 0) break;
+        size += r;
+    }
+    buffer.resize(size);
+    if (size != size_hint) buffer.shrink_to_fit();
+    result->data_ = buffer.data();
+    result->size_ = size;
+    return result;
+}
+
+std::shared_ptr<const FileContent> FileContent::MapFile(int fd,
+                                                       size_t size) {
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) return nullptr;
+    // Decoders mostly go front to back.
+    madvise(mapped, size, MADV_SEQUENTIAL);
+    std::shared_ptr<FileContent> result(new FileContent());
+    result->data_ = (const uint8_t*)mapped;
+    result->size_ = size;
+    result->mapped_ = true;
+    return result;
+}
+
+std::shared_ptr<const FileContent> FileContent::Map(const char *filename) {
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    std::shared_ptr<const FileContent> result;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        result = MapFile(fd, st.st_size);
+    }
+    close(fd);
+    return result;
+}
+
+std::shared_ptr<const FileContent> FileContent::Open(const char *filename) {
+    if (IsStdin(filename)) {
+        std::lock_guard<std::mutex> l(stdin_mutex);
+        if (!stdin_content) stdin_content = ReadAll(STDIN_FILENO);
+        return stdin_content;
+    }
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    const bool regular = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode));
+    std::shared_ptr<const FileContent> result;
+    if (regular && st.st_size > kMaxReadSize) {
+        result = MapFile(fd, st.st_size);
+    }
+    // Regular files we know the size of, pipes, devices.
+    if (!result) result = ReadAll(fd, regular ? st.st_size : 0);
+    const int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return result;
+}
+
+void FileContent::WillNeed(size_t offset, size_t length) const {
+    if (!mapped_ || offset >= size_) return;
+    // madvise() wants a page-aligned start.
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t start = offset - offset % page_size;
+    length = std::min(length + (offset - start), size_ - start);
+    madvise((void*)(data_ + start), length, MADV_WILLNEED);
+}
+
+std::shared_ptr<const FileContent> FileContent::BufferedStdin() {
+    std::lock_guard<std::mutex> l(stdin_mutex);
+    return stdin_content;
+}
+}  // namespace timg
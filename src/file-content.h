@@ -0,0 +1,78 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef FILE_CONTENT_H_
+#define FILE_CONTENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+namespace timg {
+// The content of an input file in memory, to be handed to decoders
+// without them reading it again. Huge regular files are mapped, anything
+// else is read into a buffer. What was read from stdin
+// is kept, so that after the image loader gave up on it, the video loader
+// can still have a look.
+class FileContent {
+public:
+    ~FileContent();
+
+    // Is this the name we use for stdin ?
+    static bool IsStdin(const char *filename);
+
+    // Content of "filename" or nullptr (with errno set) if it can't be read.
+    static std::shared_ptr<const FileContent> Open(const char *filename);
+
+    // Like Open(), but only for regular files, which are mapped whatever
+    // their size; nullptr for anything else.
+    static std::shared_ptr<const FileContent> Map(const char *filename);
+
+    // Content read elsewhere; takes over what is in "buffer".
+    static std::shared_ptr<const FileContent> FromBuffer(
+        std::vector<uint8_t> *buffer);
+
+    // Content of stdin if it has been read by Open() before, or nullptr.
+    static std::shared_ptr<const FileContent> BufferedStdin();
+
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+
+    // Hint that the given range will be read soon, so that the kernel can
+    // start reading it in. Only has an effect for mapped files.
+    void WillNeed(size_t offset, size_t length) const;
+
+private:
+    FileContent() {}
+    FileContent(const FileContent &) = delete;
+
+    // Read everything from "fd" until end of file; "size_hint" is how much
+    // we expect, if known.
+    static std::shared_ptr<const FileContent> ReadAll(int fd,
+                                                      size_t size_hint = 0);
+
+    // Map "size" bytes of the regular file "fd".
+    static std::shared_ptr<const FileContent> MapFile(int fd, size_t size);
+
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<uint8_t> buffer_;  // If not mapped.
+};
+}  // namespace timg
+
+#endif  // FILE_CONTENT_H_
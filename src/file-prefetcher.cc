@@ -0,0 +1,362 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "file-prefetcher.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "file-content.h"
+#include "thread-pool.h"
+
+#ifdef __has_include
+#  if __has_include(<linux/io_uring.h>)
+#    include <linux/io_uring.h>
+#    define TIMG_HAVE_IO_URING 1
+#  endif
+#endif
+
+namespace timg {
+// Number of files read ahead of the one currently shown.
+static constexpr size_t kFilesAhead = 16;
+
+// Larger files are left to the loaders, which read or map them themselves.
+static constexpr off_t kMaxPrefetchSize = 8 << 20;
+
+// Reads in flight at the same time with io_uring; threads otherwise.
+static constexpr unsigned kRingEntries = 16;
+static constexpr int kReadThreads = 4;
+
+// Open "filename" if it is a regular file we read ahead; its size is
+// stored in "size". Returns -1 if not.
+static int OpenSmallFile(const char *filename, size_t *size) {
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+        || st.st_size <= 0 || st.st_size > kMaxPrefetchSize) {
+        close(fd);
+        return -1;
+    }
+    *size = st.st_size;
+    return fd;
+}
+
+static std::shared_ptr<const FileContent> ReadFile(const char *filename) {
+    size_t size;
+    const int fd = OpenSmallFile(filename, &size);
+    if (fd < 0) return nullptr;
+    std::vector<uint8_t> buffer(size);
+    size_t filled = 0;
+    while (filled < size) {
+        const ssize_t r = read(fd, &buffer[filled], size - filled);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        filled += r;
+    }
+    close(fd);
+    buffer.resize(filled);
+    return FileContent::FromBuffer(&buffer);
+}
+
+#ifdef TIMG_HAVE_IO_URING
+// Just enough of io_uring to read files, talking to the kernel directly
+// through the system calls and the shared rings.
+class IoUring {
+public:
+    ~IoUring() {
+        if (sqes_) munmap(sqes_, sqes_size_);
+        if (cq_ring_ && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+        if (sq_ring_) munmap(sq_ring_, sq_ring_size_);
+        if (fd_ >= 0) close(fd_);
+    }
+
+    // Returns false if io_uring is not available, e.g. old kernel or
+    // forbidden in a container.
+    bool Init(unsigned entries) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd_ = syscall(__NR_io_uring_setup, entries, &params);
+        if (fd_ < 0) return false;
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(__u32);
+        cq_ring_size_ = params.cq_off.cqes
+            + params.cq_entries * sizeof(struct io_uring_cqe);
+        const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_ring_size_ = cq_ring_size_
+                = std::max(sq_ring_size_, cq_ring_size_);
+        }
+        sq_ring_ = MapRing(sq_ring_size_, IORING_OFF_SQ_RING);
+        if (!sq_ring_) return false;
+        cq_ring_ = single_mmap ? sq_ring_
+            : MapRing(cq_ring_size_, IORING_OFF_CQ_RING);
+        if (!cq_ring_) return false;
+        sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = (struct io_uring_sqe*)MapRing(sqes_size_, IORING_OFF_SQES);
+        if (!sqes_) return false;
+
+        sq_entries_ = params.sq_entries;
+        sq_head_ = (__u32*)(sq_ring_ + params.sq_off.head);
+        sq_tail_ = (__u32*)(sq_ring_ + params.sq_off.tail);
+        sq_mask_ = *(__u32*)(sq_ring_ + params.sq_off.ring_mask);
+        sq_array_ = (__u32*)(sq_ring_ + params.sq_off.array);
+        cq_head_ = (__u32*)(cq_ring_ + params.cq_off.head);
+        cq_tail_ = (__u32*)(cq_ring_ + params.cq_off.tail);
+        cq_mask_ = *(__u32*)(cq_ring_ + params.cq_off.ring_mask);
+        cqes_ = (struct io_uring_cqe*)(cq_ring_ + params.cq_off.cqes);
+        return true;
+    }
+
+    // Queue reading into "iov" from "fd" at "offset". Needs Submit() to
+    // be handed to the kernel. The "iov" needs to stay valid until done.
+    bool QueueRead(int fd, const struct iovec *iov, off_t offset,
+                   void *user_data) {
+        const __u32 tail = *sq_tail_;  // Only we write it.
+        if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_)
+            return false;
+        const __u32 index = tail & sq_mask_;
+        struct io_uring_sqe *sqe = &sqes_[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;  // Plain READ needs a newer kernel.
+        sqe->fd = fd;
+        sqe->addr = (__u64)(uintptr_t)iov;
+        sqe->len = 1;
+        sqe->off = offset;
+        sqe->user_data = (__u64)(uintptr_t)user_data;
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        ++unsubmitted_;
+        return true;
+    }
+
+    bool Submit() {
+        while (unsubmitted_ > 0) {
+            const int r = syscall(__NR_io_uring_enter, fd_, unsubmitted_,
+                                  0, 0, nullptr, 0);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return false;
+            unsubmitted_ -= r;
+        }
+        return true;
+    }
+
+    // Wait for the next completed request.
+    bool WaitCompletion(void **user_data, int *result) {
+        for (;;) {
+            const __u32 head = *cq_head_;  // Only we write it.
+            if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+                const struct io_uring_cqe *cqe = &cqes_[head & cq_mask_];
+                *user_data = (void*)(uintptr_t)cqe->user_data;
+                *result = cqe->res;
+                __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+            const int r = syscall(__NR_io_uring_enter, fd_, 0, 1,
+                                  IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (r < 0 && errno != EINTR) return false;
+        }
+    }
+
+private:
+    uint8_t *MapRing(size_t size, off_t offset) {
+        void *result = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd_, offset);
+        return result == MAP_FAILED ? nullptr : (uint8_t*)result;
+    }
+
+    int fd_ = -1;
+    uint8_t *sq_ring_ = nullptr;
+    uint8_t *cq_ring_ = nullptr;
+    struct io_uring_sqe *sqes_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    size_t sqes_size_ = 0;
+
+    __u32 sq_entries_ = 0;
+    __u32 *sq_head_, *sq_tail_, *sq_array_;
+    __u32 sq_mask_;
+    __u32 *cq_head_, *cq_tail_;
+    __u32 cq_mask_;
+    struct io_uring_cqe *cqes_;
+    unsigned unsubmitted_ = 0;
+};
+#else
+// Without io_uring headers, we always use the thread pool.
+class IoUring {
+public:
+    bool Init(unsigned entries) { return false; }
+    bool QueueRead(int fd, const struct iovec *iov, off_t offset,
+                   void *user_data) { return false; }
+    bool Submit() { return false; }
+    bool WaitCompletion(void **user_data, int *result) { return false; }
+};
+#endif
+
+// A file being read through io_uring.
+struct FilePrefetcher::Request {
+    size_t index;
+    int fd;
+    std::vector<uint8_t> buffer;
+    size_t filled = 0;
+    struct iovec iov;
+};
+
+FilePrefetcher::FilePrefetcher(const std::vector<const char *> &files)
+    : files_(files.begin(), files.end()), promises_(files.size()) {
+    for (std::promise<Content> &p : promises_) {
+        contents_.push_back(p.get_future().share());
+    }
+    ring_.reset(new IoUring());
+    if (ring_->Init(kRingEntries)) {
+        ring_thread_ = std::thread(&FilePrefetcher::RingLoop, this);
+    } else {
+        ring_.reset();
+        pool_.reset(new ThreadPool(kReadThreads));
+    }
+}
+
+FilePrefetcher::~FilePrefetcher() {
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+    if (ring_thread_.joinable()) ring_thread_.join();
+    pool_.reset();  // Before the promises its work refers to go away.
+}
+
+std::shared_ptr<const FileContent> FilePrefetcher::Get(size_t index) {
+    if (index >= files_.size()) return nullptr;
+    Schedule(std::min(index + 1 + kFilesAhead, files_.size()));
+    return contents_[index].get();
+}
+
+void FilePrefetcher::Schedule(size_t end) {
+    std::lock_guard<std::mutex> l(mutex_);
+    if (end <= wanted_) return;
+    wanted_ = end;
+    if (ring_) {
+        cond_.notify_all();
+        return;
+    }
+    for (/**/; scheduled_ < wanted_; ++scheduled_) {
+        const char *filename = files_[scheduled_].c_str();
+        std::promise<Content> *promise = &promises_[scheduled_];
+        pool_->ExecAsync([filename, promise]() {
+                promise->set_value(ReadFile(filename));
+            });
+    }
+}
+
+bool FilePrefetcher::StartRingRead(size_t index, Request *request) {
+    size_t size;
+    request->index = index;
+    request->fd = OpenSmallFile(files_[index].c_str(), &size);
+    if (request->fd < 0) {
+        promises_[index].set_value(nullptr);
+        return false;
+    }
+    request->buffer.resize(size);
+    request->iov.iov_base = request->buffer.data();
+    request->iov.iov_len = size;
+    if (!ring_->QueueRead(request->fd, &request->iov, 0, request)) {
+        close(request->fd);
+        promises_[index].set_value(ReadFile(files_[index].c_str()));
+        return false;
+    }
+    return true;
+}
+
+void FilePrefetcher::FinishRingRead(Request *request, int result) {
+    close(request->fd);
+    if (result < 0) {
+        // Let the loader try, which will report errors if needed.
+        promises_[request->index].set_value(nullptr);
+        return;
+    }
+    request->buffer.resize(request->filled);
+    promises_[request->index].set_value(
+        FileContent::FromBuffer(&request->buffer));
+}
+
+void FilePrefetcher::RingLoop() {
+    size_t next = 0;
+    std::vector<Request*> in_flight;
+    bool ring_failed = false;
+    for (;;) {
+        size_t end;
+        {
+            std::unique_lock<std::mutex> l(mutex_);
+            cond_.wait(l, [&]() {
+                    return stopping_ || next < wanted_ || !in_flight.empty();
+                });
+            // The kernel writes into our buffers; only leave once it's done.
+            if (stopping_ && in_flight.empty()) return;
+            end = stopping_ ? next : wanted_;
+        }
+        for (/**/; next < end && in_flight.size() < kRingEntries; ++next) {
+            if (ring_failed) {
+                promises_[next].set_value(ReadFile(files_[next].c_str()));
+                continue;
+            }
+            Request *request = new Request();
+            if (StartRingRead(next, request)) {
+                in_flight.push_back(request);
+            } else {
+                delete request;
+            }
+        }
+        if (in_flight.empty()) continue;
+        void *user_data;
+        int result;
+        if (!ring_->Submit() || !ring_->WaitCompletion(&user_data, &result)) {
+            // Should not happen. We can't tell what the kernel still does
+            // with the buffers in flight, so we leave them be and read the
+            // remaining files ourselves.
+            for (Request *request : in_flight) {
+                promises_[request->index].set_value(nullptr);
+            }
+            in_flight.clear();
+            ring_failed = true;
+            continue;
+        }
+        Request *request = (Request*)user_data;
+        if (result > 0) {
+            request->filled += result;
+            // Short read; continue with the rest.
+            if (request->filled < request->buffer.size()) {
+                request->iov.iov_base = &request->buffer[request->filled];
+                request->iov.iov_len = request->buffer.size() - request->filled;
+                if (ring_->QueueRead(request->fd, &request->iov,
+                                     request->filled, request)) {
+                    continue;
+                }
+            }
+        }
+        FinishRingRead(request, result);
+        in_flight.erase(std::find(in_flight.begin(), in_flight.end(),
+                                  request));
+        delete request;
+    }
+}
+}  // namespace timg
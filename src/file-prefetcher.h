@@ -0,0 +1,79 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef FILE_PREFETCHER_H_
+#define FILE_PREFETCHER_H_
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace timg {
+class FileContent;
+class IoUring;
+class ThreadPool;
+
+// Reads the files we're going to show next into memory while we're busy
+// decoding and showing the current one, so that latency of the disk or
+// network file system is not added to every file. Reads are done with
+// io_uring where the kernel supports it, otherwise on a thread pool.
+// Only small regular files are read ahead; everything else is left to be
+// read by the loaders themselves.
+class FilePrefetcher {
+public:
+    explicit FilePrefetcher(const std::vector<const char *> &files);
+    ~FilePrefetcher();
+
+    // Content of file "index", waiting until it has been read. Returns
+    // nullptr if it is not read ahead; the loaders then read it themselves.
+    // Files are expected to be requested in order; this moves the window
+    // of files read ahead.
+    std::shared_ptr<const FileContent> Get(size_t index);
+
+private:
+    typedef std::shared_ptr<const FileContent> Content;
+    struct Request;
+
+    // Make sure files up to "end" are being read.
+    void Schedule(size_t end);
+
+    // Thread submitting reads to io_uring and collecting the completions.
+    void RingLoop();
+    bool StartRingRead(size_t index, Request *request);
+    void FinishRingRead(Request *request, int result);
+
+    std::vector<std::string> files_;
+    std::vector<std::promise<Content>> promises_;
+    std::vector<std::shared_future<Content>> contents_;
+
+    std::unique_ptr<IoUring> ring_;    // If available, or ...
+    std::unique_ptr<ThreadPool> pool_;  // ... as fallback.
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    size_t scheduled_ = 0;  // Files up to here are being read.
+    size_t wanted_ = 0;     // Files up to here should be read.
+    bool stopping_ = false;
+    std::thread ring_thread_;
+};
+}  // namespace timg
+
+#endif  // FILE_PREFETCHER_H_
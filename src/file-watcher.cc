@@ -0,0 +1,80 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "file-watcher.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace timg {
+FileWatcher::FileWatcher()
+    : inotify_fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) {
+    if (inotify_fd_ < 0) perror("inotify");
+}
+
+FileWatcher::~FileWatcher() {
+    if (inotify_fd_ >= 0) close(inotify_fd_);
+}
+
+int FileWatcher::Watch(const char *filename) {
+    if (inotify_fd_ < 0) return -1;
+    const std::string path(filename);
+    const size_t slash = path.find_last_of('/');
+    std::string directory = ".";
+    if (slash != std::string::npos) {
+        directory = (slash == 0) ? "/" : path.substr(0, slash);
+    }
+    // Written in place or replaced by rename(). The same directory watched
+    // again yields the same watch descriptor.
+    const int wd = inotify_add_watch(inotify_fd_, directory.c_str(),
+                                     IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0) {
+        fprintf(stderr, "%s: can't watch for changes: %s\n",
+                filename, strerror(errno));
+    }
+    files_.push_back({ wd, path.substr(slash == std::string::npos
+                                       ? 0 : slash + 1) });
+    return wd < 0 ? -1 : files_.size() - 1;
+}
+
+std::vector<int> FileWatcher::ReadChanges() {
+    std::vector<int> result;
+    char buffer[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(inotify_fd_, buffer, sizeof(buffer))) > 0) {
+        const struct inotify_event *event;
+        for (char *pos = buffer; pos < buffer + len;
+             pos += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *) pos;
+            if (event->len == 0) continue;
+            for (size_t i = 0; i < files_.size(); ++i) {
+                if (files_[i].watch_descriptor == event->wd &&
+                    files_[i].basename == event->name &&
+                    std::find(result.begin(), result.end(), (int)i)
+                    == result.end()) {
+                    result.push_back(i);
+                }
+            }
+        }
+    }
+    return result;
+}
+}  // namespace timg
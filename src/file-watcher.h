@@ -0,0 +1,57 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef FILE_WATCHER_H_
+#define FILE_WATCHER_H_
+
+#include <string>
+#include <vector>
+
+namespace timg {
+// Reports files that have been written or replaced.
+// Uses inotify on the directories containing the files, so that a file
+// atomically replaced by renaming another file over it is noticed as well
+// as one that is rewritten in place. Only completed writes are reported,
+// not every single write() while a file is being produced.
+class FileWatcher {
+public:
+    FileWatcher();
+    ~FileWatcher();
+
+    // Start watching "filename". Returns its index to be reported by
+    // ReadChanges(), or -1 if it can't be watched. Files are numbered in
+    // the order they are added, including the ones that can't be watched.
+    int Watch(const char *filename);
+
+    // File descriptor that becomes readable when there are changes, e.g.
+    // for EventLoop::WatchInput(). -1 if inotify is not available.
+    int fd() const { return inotify_fd_; }
+
+    // Read pending notifications and return indices of the files that
+    // changed. Does not block.
+    std::vector<int> ReadChanges();
+
+private:
+    struct WatchedFile {
+        int watch_descriptor;
+        std::string basename;
+    };
+
+    int inotify_fd_;
+    std::vector<WatchedFile> files_;
+};
+}  // namespace timg
+
+#endif  // FILE_WATCHER_H_
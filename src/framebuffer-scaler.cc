@@ -0,0 +1,73 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+
+#include "framebuffer-scaler.h"
+
+#include <assert.h>
+
+#include <algorithm>
+
+namespace timg {
+static std::vector<int> ComputeSpans(int source_size, int target_size) {
+    std::vector<int> result(target_size + 1);
+    for (int i = 0; i <= target_size; ++i) {
+        result[i] = (int)((int64_t)i * source_size / target_size);
+    }
+    return result;
+}
+
+FramebufferScaler::FramebufferScaler(int source_width, int source_height,
+                                     int target_width, int target_height)
+    : x_span_(ComputeSpans(source_width, target_width)),
+      y_span_(ComputeSpans(source_height, target_height)) {
+}
+
+void FramebufferScaler::Scale(const Framebuffer &source,
+                              Framebuffer *target) const {
+    assert(source.width() == x_span_.back());
+    assert(source.height() == y_span_.back());
+    assert(target->width() == target_width());
+    assert(target->height() == target_height());
+    const int width = target_width();
+    std::vector<uint32_t> sum(3 * width);
+    for (int y = 0; y < target_height(); ++y) {
+        const int y_begin = y_span_[y];
+        const int y_end = std::max(y_span_[y+1], y_begin + 1);
+        std::fill(sum.begin(), sum.end(), 0);
+        for (int sy = y_begin; sy < y_end; ++sy) {
+            const Framebuffer::rgb_t *const row = source.row(sy);
+            uint32_t *s = sum.data();
+            for (int x = 0; x < width; ++x, s += 3) {
+                const int x_end = std::max(x_span_[x+1], x_span_[x] + 1);
+                for (int sx = x_span_[x]; sx < x_end; ++sx) {
+                    s[0] += (row[sx] >> 16) & 0xff;
+                    s[1] += (row[sx] >> 8) & 0xff;
+                    s[2] += row[sx] & 0xff;
+                }
+            }
+        }
+        Framebuffer::rgb_t *out = target->row(y);
+        const uint32_t *s = sum.data();
+        for (int x = 0; x < width; ++x, s += 3) {
+            const uint32_t count = (y_end - y_begin)
+                * std::max(x_span_[x+1] - x_span_[x], 1);
+            out[x] = (((s[0] + count/2) / count) << 16)
+                | (((s[1] + count/2) / count) << 8)
+                | ((s[2] + count/2) / count);
+        }
+    }
+}
+}  // namespace timg
@@ -0,0 +1,50 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+
+#ifndef FRAMEBUFFER_SCALER_H_
+#define FRAMEBUFFER_SCALER_H_
+
+#include <vector>
+
+#include "terminal-canvas.h"
+
+namespace timg {
+// Scales framebuffers of one size to another, e.g. all frames of a video
+// stream that is not decoded by libav. Each target pixel is the average of
+// the source pixels it covers (box filter); when enlarging, pixels are
+// replicated. The spans are computed once, so scaling a frame is a single
+// pass over the source.
+class FramebufferScaler {
+public:
+    FramebufferScaler(int source_width, int source_height,
+                      int target_width, int target_height);
+
+    int target_width() const { return (int)x_span_.size() - 1; }
+    int target_height() const { return (int)y_span_.size() - 1; }
+
+    // Scale "source" into "target"; both need to have the sizes given in
+    // the constructor.
+    void Scale(const Framebuffer &source, Framebuffer *target) const;
+
+private:
+    // Source pixels [span[i], span[i+1]) make up target pixel i; if empty,
+    // the single source pixel span[i] is used.
+    std::vector<int> x_span_;
+    std::vector<int> y_span_;
+};
+}  // namespace timg
+
+#endif  // FRAMEBUFFER_SCALER_H_
@@ -0,0 +1,193 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "image-browser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "event-loop.h"
+#include "terminal-canvas.h"
+#include "thread-pool.h"
+
+namespace timg {
+// Number of images in each direction we load ahead of time.
+static constexpr int kPrefetchDistance = 2;
+
+ImageBrowser::ImageBrowser(const std::vector<const char *> &files,
+                           int display_width, int display_height,
+                           const DisplayOptions &options,
+                           const char *bg_color, const char *pattern_color,
+                           size_t cache_bytes, ThreadPool *pool)
+    : files_(files),
+      display_width_(display_width), display_height_(display_height),
+      options_(options),
+      bg_color_(bg_color), pattern_color_(pattern_color),
+      cache_bytes_(cache_bytes), pool_(pool) {
+}
+
+ImageBrowser::~ImageBrowser() {}
+
+ImageBrowser::CacheEntry *ImageBrowser::Request(int index) {
+    auto found = cache_.find(index);
+    if (found != cache_.end()) {
+        lru_.splice(lru_.begin(), lru_, found->second.lru_pos);
+        return &found->second;
+    }
+
+    // Everything the worker needs is copied, so that it does not matter if
+    // we're gone by the time it runs.
+    const char *const filename = files_[index];
+    const int width = display_width_;
+    const int height = display_height_;
+    const DisplayOptions options = options_;
+    const char *const bg_color = bg_color_;
+    const char *const pattern_color = pattern_color_;
+
+    CacheEntry &entry = cache_[index];
+    entry.loader = pool_->ExecAsync([=]() -> LoaderPtr {
+            LoaderPtr loader(new ImageLoader());
+            if (!loader->LoadAndScale(filename, width, height, options,
+                                      bg_color, pattern_color)) {
+                return LoaderPtr();
+            }
+            return loader;
+        }).share();
+    lru_.push_front(index);
+    entry.lru_pos = lru_.begin();
+    return &entry;
+}
+
+ImageBrowser::LoaderPtr ImageBrowser::Get(int index) {
+    CacheEntry *entry = Request(index);
+    const LoaderPtr &result = entry->loader.get();
+    entry->bytes = result ? result->memory_used() : 0;
+    return result;
+}
+
+void ImageBrowser::EvictAround(int current) {
+    size_t total = 0;
+    for (auto &it : cache_) {
+        CacheEntry &entry = it.second;
+        if (entry.bytes == 0 &&
+            entry.loader.wait_for(std::chrono::seconds(0))
+            == std::future_status::ready) {
+            const LoaderPtr &loader = entry.loader.get();
+            entry.bytes = loader ? loader->memory_used() : 0;
+        }
+        total += entry.bytes;
+    }
+
+    // Oldest first, but never what we're looking at or prefetching.
+    auto pos = lru_.end();
+    while (total > cache_bytes_ && pos != lru_.begin()) {
+        --pos;
+        const int index = *pos;
+        if (abs(index - current) <= kPrefetchDistance)
+            continue;
+        auto found = cache_.find(index);
+        total -= found->second.bytes;
+        cache_.erase(found);   // A still running load finishes unnoticed.
+        pos = lru_.erase(pos);
+    }
+}
+
+void ImageBrowser::Run(Duration duration, int max_frames, int loops,
+                       EventLoop *event_loop, TerminalCanvas *canvas) {
+    event_loop->SetExitKeys({ 'n', 'p', 'g', '\n',
+                '0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
+                EventLoop::kKeyUp, EventLoop::kKeyDown,
+                EventLoop::kKeyPageUp, EventLoop::kKeyPageDown,
+                EventLoop::kKeyHome, EventLoop::kKeyEnd });
+    const int count = (int)files_.size();
+    int current = 0;
+    int typed_number = 0;
+    bool needs_show = true;
+    while (!event_loop->interrupted()) {
+        if (needs_show) {
+            const LoaderPtr loader = Get(current);
+            for (int d = 1; d <= kPrefetchDistance; ++d) {
+                if (current + d < count) Request(current + d);
+                if (current - d >= 0) Request(current - d);
+            }
+            EvictAround(current);
+
+            canvas->ClearScreen();
+            printf("[%d/%d] %s\n", current + 1, count, files_[current]);
+            fflush(stdout);
+            if (loader) {
+                loader->Display(duration, max_frames, loops,
+                                event_loop, canvas);
+            } else {
+                printf("(couldn't load)\n");
+                fflush(stdout);
+            }
+            needs_show = false;
+        }
+
+        int key = event_loop->TakeExitKey();
+        if (key == EventLoop::kKeyNone) {
+            const EventLoop::Event event = event_loop->WaitUntil(
+                Time::Now() + Duration::InfiniteFuture());
+            if (event == EventLoop::Event::kResize) {
+                // Everything we have is scaled for the old size.
+                display_width_ = event_loop->terminal_pixel_width();
+                display_height_ = event_loop->terminal_pixel_height();
+                cache_.clear();
+                lru_.clear();
+                needs_show = true;
+                continue;
+            }
+            if (event != EventLoop::Event::kKey) continue;
+            key = event_loop->key();
+        }
+
+        const int previous = current;
+        switch (key) {
+        case 'q':
+            event_loop->SetExitKeys({});
+            return;
+        case 'n': case ' ':
+        case EventLoop::kKeyDown: case EventLoop::kKeyPageDown:
+            current = std::min(current + 1, count - 1);
+            break;
+        case 'p':
+        case EventLoop::kKeyUp: case EventLoop::kKeyPageUp:
+            current = std::max(current - 1, 0);
+            break;
+        case EventLoop::kKeyHome:
+            current = 0;
+            break;
+        case EventLoop::kKeyEnd:
+            current = count - 1;
+            break;
+        case '\n': case 'g':
+            if (typed_number >= 1 && typed_number <= count)
+                current = typed_number - 1;
+            typed_number = 0;
+            break;
+        default:
+            if (key >= '0' && key <= '9')
+                typed_number = 10 * typed_number + (key - '0');
+            break;
+        }
+        needs_show = (current != previous);
+    }
+    event_loop->SetExitKeys({});
+}
+}  // namespace timg
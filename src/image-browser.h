@@ -0,0 +1,91 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef IMAGE_BROWSER_H_
+#define IMAGE_BROWSER_H_
+
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "image-display.h"
+#include "timg-time.h"
+
+namespace timg {
+class EventLoop;
+class TerminalCanvas;
+class ThreadPool;
+
+// Interactive browsing through a list of images: next ('n', cursor down,
+// page down), previous ('p', cursor up, page up), first/last (home/end) or
+// jump to a number typed followed by enter or 'g'.
+// Loaded and scaled images are kept in a memory-bounded LRU cache, and the
+// neighbors in both directions are prefetched on worker threads, so that
+// flipping between images does not need to wait for decoding.
+class ImageBrowser {
+public:
+    // Browse "files", scaled to fit "display_width"x"display_height" with
+    // the given options. "bg_color" and "pattern_color" as in
+    // ImageLoader::LoadAndScale(). Keeps up to "cache_bytes" of loaded
+    // images; loading happens on "pool".
+    ImageBrowser(const std::vector<const char *> &files,
+                 int display_width, int display_height,
+                 const DisplayOptions &options,
+                 const char *bg_color, const char *pattern_color,
+                 size_t cache_bytes, ThreadPool *pool);
+    ImageBrowser(const ImageBrowser &) = delete;
+    ~ImageBrowser();
+
+    // Run until the user quits. Animations are played limited by
+    // "duration", "max_frames" and "loops" as in ImageLoader::Display().
+    void Run(Duration duration, int max_frames, int loops,
+             EventLoop *event_loop, TerminalCanvas *canvas);
+
+private:
+    typedef std::shared_ptr<ImageLoader> LoaderPtr;
+    struct CacheEntry {
+        std::shared_future<LoaderPtr> loader;
+        std::list<int>::iterator lru_pos;
+        size_t bytes = 0;    // Known once loaded.
+    };
+
+    // Get entry for image at "index", scheduling its loading if needed and
+    // marking it as most recently used.
+    CacheEntry *Request(int index);
+
+    // Wait for the loader of "index"; nullptr if not loadable.
+    LoaderPtr Get(int index);
+
+    // Drop least recently used entries until we're within budget, keeping
+    // the ones around "current".
+    void EvictAround(int current);
+
+    const std::vector<const char *> files_;
+    int display_width_;
+    int display_height_;
+    const DisplayOptions options_;
+    const char *const bg_color_;
+    const char *const pattern_color_;
+    const size_t cache_bytes_;
+    ThreadPool *const pool_;
+
+    std::map<int, CacheEntry> cache_;
+    std::list<int> lru_;   // Most recently used first.
+};
+}  // namespace timg
+
+#endif  // IMAGE_BROWSER_H_
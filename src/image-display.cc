@@ -15,16 +15,31 @@
 
 #include "image-display.h"
 
+#include "event-loop.h"
+#include "fast-decoder.h"
+#include "file-content.h"
+#include "framebuffer-scaler.h"
+#include "large-image.h"
 #include "terminal-canvas.h"
+#include "thread-pool.h"
 #include "timg-time.h"
 
 #include <algorithm>
+#include <future>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <string>
+#include <limits.h>
 #include <string.h>
 #include <assert.h>
 #include <math.h>
 #include <Magick++.h>
 
 namespace timg {
+// Minimum size of the source image we keep around for re-layout.
+static constexpr int kMinRetainedSize = 2048;
+
 // Returns 'true' if anything is to do to the picture.
 bool ScaleToFit(int img_width, int img_height,
                 const int screen_width, const int screen_height,
@@ -79,39 +94,82 @@ bool ScaleToFit(int img_width, int img_height,
 void CopyToFramebuffer(const Magick::Image &img, timg::Framebuffer *result) {
     assert(result->width() >= (int) img.columns()
            && result->height() >= (int) img.rows());
+    // Fetch rows in bulk from the pixel cache instead of going through
+    // a Magick::Color per pixel; matters for really large images.
     for (size_t y = 0; y < img.rows(); ++y) {
-        for (size_t x = 0; x < img.columns(); ++x) {
-            const Magick::Color &c = img.pixelColor(x, y);
-            if (c.alphaQuantum() >= 255)
-                continue;
-            result->SetPixel(x, y,
-                             ScaleQuantumToChar(c.redQuantum()),
-                             ScaleQuantumToChar(c.greenQuantum()),
-                             ScaleQuantumToChar(c.blueQuantum()));
+        const Magick::PixelPacket *pixel =
+            img.getConstPixels(0, y, img.columns(), 1);
+        if (!pixel) return;
+        Framebuffer::rgb_t *out = result->row(y);
+        for (size_t x = 0; x < img.columns(); ++x, ++pixel) {
+            if (ScaleQuantumToChar(pixel->opacity) >= 255)
+                continue;   // Fully transparent.
+            out[x] = (ScaleQuantumToChar(pixel->red) << 16
+                      | ScaleQuantumToChar(pixel->green) << 8
+                      | ScaleQuantumToChar(pixel->blue));
         }
     }
 }
 
+// Like CopyToFramebuffer(), but to position "x", "y" in "result", over
+// what is there already: fully transparent pixels are set to black.
+static void CopyRegionToFramebuffer(const Magick::Image &img, int x, int y,
+                                    timg::Framebuffer *result) {
+    assert(x + (int)img.columns() <= result->width()
+           && y + (int)img.rows() <= result->height());
+    for (size_t row = 0; row < img.rows(); ++row) {
+        const Magick::PixelPacket *pixel =
+            img.getConstPixels(0, row, img.columns(), 1);
+        if (!pixel) return;
+        Framebuffer::rgb_t *out = result->row(y + row) + x;
+        for (size_t col = 0; col < img.columns(); ++col, ++pixel) {
+            out[col] = (ScaleQuantumToChar(pixel->opacity) >= 255)
+                ? 0
+                : (ScaleQuantumToChar(pixel->red) << 16
+                   | ScaleQuantumToChar(pixel->green) << 8
+                   | ScaleQuantumToChar(pixel->blue));
+        }
+    }
+}
+
+// Delay before showing the next frame of an animation.
+static Duration DurationFromImgDelay(const Magick::Image &img) {
+    int delay_time = img.animationDelay();  // in 1/100s of a second.
+    if (delay_time < 1) delay_time = 10;
+    return Duration::Millis(delay_time * 10);
+}
+
 // Frame already prepared as the buffer to be sent, so copy to terminal-buffer
 // does not have to be done online. Also knows about the animation delay.
 class ImageLoader::PreprocessedFrame {
 public:
     PreprocessedFrame(const Magick::Image &img)
         : delay_(DurationFromImgDelay(img)),
-          framebuffer_(img.columns(), img.rows()) {
-        CopyToFramebuffer(img, &framebuffer_);
+          framebuffer_(new Framebuffer(img.columns(), img.rows())) {
+        CopyToFramebuffer(img, framebuffer_.get());
     }
+    // A frame of the given size; the pixels are filled in by the caller
+    // through mutable_framebuffer().
+    PreprocessedFrame(int width, int height, Duration delay)
+        : delay_(delay), framebuffer_(new Framebuffer(width, height)) {}
     Duration delay() const { return delay_; }
-    const timg::Framebuffer &framebuffer() const { return framebuffer_; }
+    const timg::Framebuffer &framebuffer() const { return *framebuffer_; }
+    timg::Framebuffer *mutable_framebuffer() { return framebuffer_.get(); }
 
-private:
-    static Duration DurationFromImgDelay(const Magick::Image &img) {
-        int delay_time = img.animationDelay();  // in 1/100s of a second.
-        if (delay_time < 1) delay_time = 10;
-        return Duration::Millis(delay_time * 10);
+    // Frames with the same content id have identical pixels.
+    int content_id() const { return content_id_; }
+    void set_content_id(int id) { content_id_ = id; }
+
+    // Use the pixels of "other", which are the same as ours.
+    void ShareWith(const PreprocessedFrame &other) {
+        framebuffer_ = other.framebuffer_;
+        content_id_ = other.content_id_;
     }
+
+private:
     const Duration delay_;
-    timg::Framebuffer framebuffer_;
+    std::shared_ptr<timg::Framebuffer> framebuffer_;
+    int content_id_ = -1;
 };
 
 static void RenderBackground(int width, int height,
@@ -133,6 +191,8 @@ static void RenderBackground(int width, int height,
 
 ImageLoader::~ImageLoader() {
     for (PreprocessedFrame *f : frames_) delete f;
+    delete retained_;
+    delete direct_source_;
 }
 
 const char *ImageLoader::VersionInfo() {
@@ -146,6 +206,199 @@ static bool EndsWith(const char *filename, const char *suffix) {
     return strcasecmp(filename + flen - slen, suffix) == 0;
 }
 
+// Size of the canvas the frames of an animation are placed on, starting
+// with "first".
+static void CanvasSize(const Magick::Image &first, int *width, int *height) {
+    const Magick::Geometry page = first.page();
+    *width = page.width() > 0 ? (int)page.width() : (int)first.columns();
+    *height = page.height() > 0 ? (int)page.height() : (int)first.rows();
+}
+
+// Decode images from "content" in memory. The "filename" only serves as
+// a hint for the format. If "max_frames" is positive, only that many
+// frames are decoded. Vector images are rendered at "density" dots per
+// inch if that is positive.
+static bool ReadFromMemory(const FileContent &content, const char *filename,
+                           int max_frames, int density,
+                           std::vector<Magick::Image> *frames) {
+    MagickLib::ImageInfo *info = MagickLib::CloneImageInfo(nullptr);
+    if (!FileContent::IsStdin(filename)) {
+        strncpy(info->filename, filename, sizeof(info->filename) - 1);
+    }
+    if (max_frames > 0) {
+        info->subimage = 0;
+        info->subrange = max_frames;
+    }
+    if (density > 0) {
+        const std::string dpi = std::to_string(density);
+        MagickLib::CloneString(&info->density, (dpi + "x" + dpi).c_str());
+    }
+    MagickLib::ExceptionInfo exception;
+    MagickLib::GetExceptionInfo(&exception);
+    MagickLib::Image *images = MagickLib::BlobToImage(info, content.data(),
+                                                      content.size(),
+                                                      &exception);
+    MagickLib::DestroyExceptionInfo(&exception);
+    MagickLib::DestroyImageInfo(info);
+    if (!images) return false;  // Warnings still give us images.
+    Magick::insertImages(frames, images);  // Takes ownership.
+    return true;
+}
+
+// Read images from "filename", or from its "content" if already in memory.
+// If "max_frames" is positive, only the first frames are read.
+static bool ReadFrames(const char *filename,
+                       std::shared_ptr<const FileContent> content,
+                       int max_frames, std::vector<Magick::Image> *frames) {
+    if (strchr(filename, '[') == nullptr) {
+        // Decode straight from the mapped file, or from stdin read once,
+        // so that other loaders can look at it if we fail.
+        if (!content) content = FileContent::Open(filename);
+        if (!content || !ReadFromMemory(*content, filename, max_frames, 0,
+                                        frames)) {
+            return false;
+        }
+    } else {
+        // Subimage specs are taken care of by Magick when it reads itself.
+        try {
+            readImages(frames, filename);
+        }
+        catch(Magick::Warning &warning) {
+            //fprintf(stderr, "Meh: %s (%s)\n", filename, warning.what());
+        }
+        catch (std::exception& e) {
+            return false;
+        }
+    }
+    if (max_frames > 0 && (int)frames->size() > max_frames) {
+        frames->resize(max_frames);
+    }
+    return true;
+}
+
+// Is this a vector format with a single page we can render at a density of
+// our choosing ? Documents only if a single page is addressed.
+static bool IsSingleVectorImage(const std::string &filename) {
+    const size_t spec = filename.find('[');
+    const std::string name = filename.substr(0, spec);
+    if (EndsWith(name.c_str(), ".svg") || EndsWith(name.c_str(), ".svgz")
+        || EndsWith(name.c_str(), ".eps")) {
+        return true;
+    }
+    return spec != std::string::npos
+        && (EndsWith(name.c_str(), ".pdf") || EndsWith(name.c_str(), ".ps"));
+}
+
+// Render a vector image once at the size we're going to show it: ping the
+// size at the default density, then read it at the density that results
+// in the ScaleToFit() target. Both are done from "content" if given, which
+// is that of the whole file; subimage specs in "filename" need Magick to
+// read the file itself. Returns false if that didn't work.
+static bool ReadRasterized(const char *filename, const FileContent *content,
+                           int display_width, int display_height,
+                           const DisplayOptions &options,
+                           std::vector<Magick::Image> *frames) {
+    static constexpr double kDefaultDensity = 72.0;  // Magick's default.
+    int width, height;
+    if (content) {
+        if (!PingFromMemory(*content, filename, -1, &width, &height))
+            return false;
+    } else {
+        Magick::Image probe;
+        try {
+            probe.ping(filename);
+        }
+        catch (Magick::Warning &warning) {
+        }
+        catch (std::exception &e) {
+            return false;
+        }
+        width = probe.columns();
+        height = probe.rows();
+    }
+    if (width == 0 || height == 0) return false;
+
+    int target_width, target_height;
+    ScaleToFit(width, height, display_width, display_height,
+               options, &target_width, &target_height);
+    // Density is given in whole dots per inch; round up, so that at most
+    // a small reduction is left to do.
+    const double factor = std::max((double)target_width / width,
+                                   (double)target_height / height);
+    const int density = std::max(1, (int)ceil(kDefaultDensity * factor));
+
+    if (content) {
+        const size_t before = frames->size();
+        return ReadFromMemory(*content, filename, 1, density, frames)
+            && frames->size() > before
+            && frames->back().columns() > 0 && frames->back().rows() > 0;
+    }
+
+    Magick::Image img;
+    img.density(Magick::Geometry(density, density));
+    try {
+        img.read(filename);
+    }
+    catch (Magick::Warning &warning) {
+    }
+    catch (std::exception &e) {
+        return false;
+    }
+    if (img.columns() == 0 || img.rows() == 0) return false;
+    frames->push_back(img);
+    return true;
+}
+
+// Number of frames from the start of the animation until it has been
+// shown for at least "duration".
+static size_t FramesWithin(const std::vector<Magick::Image> &frames,
+                           Duration duration) {
+    int64_t total = 0;
+    for (size_t i = 0; i < frames.size(); ++i) {
+        total += DurationFromImgDelay(frames[i]).nanoseconds();
+        if (total >= duration.nanoseconds()) return i + 1;
+    }
+    return frames.size();
+}
+
+// Icons contain the same picture in various sizes. Ping them all in
+// "content" and return the index of the smallest one that doesn't need to
+// be scaled up to be shown, or the largest if all are too small. Returns
+// -1 if there is none.
+static int BestFittingIcon(const FileContent &content, const char *filename,
+                           int display_width, int display_height,
+                           const DisplayOptions &options) {
+    static constexpr int kMaxIcons = 64;
+    int best = -1;
+    int best_area = 0;
+    bool best_is_large_enough = false;
+    for (int i = 0; i < kMaxIcons; ++i) {
+        int width, height;
+        if (!PingFromMemory(content, filename, i, &width, &height))
+            break;  // No more subimages.
+        DisplayOptions fit_options = options;
+        fit_options.upscale = true;
+        int target_width, target_height;
+        ScaleToFit(width, height, display_width, display_height, fit_options,
+                   &target_width, &target_height);
+        const bool large_enough = (width >= target_width);
+        const int area = width * height;
+        if (best < 0
+            || (large_enough && (!best_is_large_enough || area < best_area))
+            || (!large_enough && !best_is_large_enough && area > best_area)) {
+            best = i;
+            best_area = area;
+            best_is_large_enough = large_enough;
+        }
+    }
+    return best;
+}
+
+void ImageLoader::SetPlaybackLimits(int max_frames, Duration duration) {
+    max_frames_ = max_frames;
+    max_duration_ = duration;
+}
+
 bool ImageLoader::LoadAndScale(const char *filename,
                                int display_width, int display_height,
                                const DisplayOptions &display_options,
@@ -154,15 +407,81 @@ bool ImageLoader::LoadAndScale(const char *filename,
     display_width_ = display_width;
     display_height_ = display_height;
     center_horizontally_ = display_options.center_horizontally;
+    options_ = display_options;
+    bg_color_ = bg_color;
+    pattern_color_ = pattern_color;
 
-    std::vector<Magick::Image> frames;
-    try {
-        readImages(&frames, filename);
+    // Everything is decoded from the content read once, unless a subimage
+    // is selected; Magick has to read those itself.
+    std::shared_ptr<const FileContent> whole_file;
+    if (strchr(filename, '[') == nullptr) {
+        whole_file = content_ ? content_ : FileContent::Open(filename);
     }
-    catch(Magick::Warning &warning) {
-        //fprintf(stderr, "Meh: %s (%s)\n", filename, warning.what());
+
+    // Size we reduce the source to. If we fill the width, the image is
+    // shown in its full length, so that is not limited (and vice versa).
+    const int keep_width = display_options.fill_height
+        && !display_options.fill_width
+        ? INT_MAX : std::max(kMinRetainedSize, 2 * display_width);
+    const int keep_height = display_options.fill_width
+        && !display_options.fill_height
+        ? INT_MAX : std::max(kMinRetainedSize, 2 * display_height);
+
+    // Plain JPEGs, PNGs and WebPs are decoded right into a framebuffer,
+    // which is then the source we keep. Transparent ones only if no
+    // background is to be composited, and nothing that is to be cropped or
+    // trimmed. If the source is kept for a re-layout, it is decoded at the
+    // size we retain, otherwise just large enough for the display.
+    if (!scroll_only_ && display_options.crop_border == 0
+        && !display_options.auto_trim_image) {
+        if (whole_file && keep_source_) {
+            DisplayOptions fit_in_box;
+            direct_source_ = DecodeFast(*whole_file, keep_width, keep_height,
+                                        fit_in_box,
+                                        !bg_color && !pattern_color);
+        } else if (whole_file) {
+            direct_source_ = DecodeFast(*whole_file,
+                                        display_width, display_height,
+                                        display_options,
+                                        !bg_color && !pattern_color);
+        }
+        if (direct_source_) {
+            is_animation_ = false;
+            return ScaleAndReleaseSource();
+        }
     }
-    catch (std::exception& e) {
+
+    // Of an icon, we only need the one size that suits us best.
+    std::string source = filename;
+    if (whole_file && EndsWith(filename, "ico")
+        && strcmp(filename, "-") != 0) {
+        const int icon = BestFittingIcon(*whole_file, filename, display_width,
+                                         display_height, display_options);
+        if (icon >= 0) source += "[" + std::to_string(icon) + "]";
+    }
+    // Content given is that of the whole file, not of a selected subimage.
+    const std::shared_ptr<const FileContent> content
+        = (source == filename) ? whole_file : nullptr;
+
+    // Vector images are rendered right away at the size we need, and huge
+    // images scaled down while decoding, unless cropping or trimming changes
+    // what that size is.
+    const bool reduce_early = display_options.crop_border == 0
+        && !display_options.auto_trim_image;
+    std::vector<Magick::Image> frames;
+    const bool rasterized = reduce_early && IsSingleVectorImage(source)
+        && ReadRasterized(source.c_str(), content.get(),
+                          display_width, display_height,
+                          display_options, &frames);
+
+    // Huge images are scaled down to the size we retain while decoding.
+    Magick::Image large;
+    const bool streamed = reduce_early && !rasterized && content
+        && ReadLargeImage(*content, filename, keep_width, keep_height,
+                          &large);
+    if (streamed) frames.push_back(large);
+    if (!rasterized && !streamed
+        && !ReadFrames(source.c_str(), content, max_frames_, &frames)) {
         // No message, let that file be handled by the next handler.
         return false;
     }
@@ -176,14 +495,31 @@ bool ImageLoader::LoadAndScale(const char *filename,
     // got back (or is there ?), so we use a blacklist approach here: filenames
     // that are known to be containers for multiple independent images are
     // considered not an animation.
-    const bool could_be_animation =
-        !EndsWith(filename, "ico") && !EndsWith(filename, "pdf");
+    const bool could_be_animation = !EndsWith(filename, "ico")
+        && !EndsWith(filename, "pdf") && !EndsWith(filename, "tif")
+        && !EndsWith(filename, "tiff");
 
     std::vector<Magick::Image> result;
-    // Put together the animation from single frames. GIFs can have nasty
-    // disposal modes, but they are handled nicely by coalesceImages()
     if (frames.size() > 1 && could_be_animation) {
-        Magick::coalesceImages(&result, frames.begin(), frames.end());
+        // Each frame only builds on the ones before, so we can stop at the
+        // last one we get to show.
+        const size_t needed = FramesWithin(frames, max_duration_);
+        int canvas_width, canvas_height;
+        CanvasSize(frames[0], &canvas_width, &canvas_height);
+        if (!pattern_color && !scroll_only_
+            && canvas_width <= keep_width && canvas_height <= keep_height) {
+            // Keep the frames as they are in the file, typically just the
+            // region that changed; ScaleFrameDeltas() puts them together.
+            result.insert(result.end(), frames.begin(),
+                          frames.begin() + needed);
+            frame_deltas_ = true;
+        } else {
+            // The pattern needs to line up with whole frames. GIFs can have
+            // nasty disposal modes, but they are handled nicely by
+            // coalesceImages()
+            Magick::coalesceImages(&result, frames.begin(),
+                                   frames.begin() + needed);
+        }
         is_animation_ = true;
     } else {
         result.insert(result.end(), frames.begin(), frames.end());
@@ -205,84 +541,637 @@ bool ImageLoader::LoadAndScale(const char *filename,
             }
         }
 
+        // We keep the source around to be able to re-layout on terminal
+        // resize. No terminal is wider than a few thousand columns, so a
+        // reduced level of huge images is all we need.
+        if (!frame_deltas_
+            && ((int)img.columns() > keep_width
+                || (int)img.rows() > keep_height)) {
+            DisplayOptions fit_in_box;
+            int w, h;
+            ScaleToFit(img.columns(), img.rows(), keep_width, keep_height,
+                       fit_in_box, &w, &h);
+            const size_t delay = img.animationDelay();
+            img.scale(Magick::Geometry(w, h));
+            img.animationDelay(delay);
+        }
+    }
+    retained_ = new std::vector<Magick::Image>();
+    retained_->swap(result);
+
+    // When scrolling, bands are scaled as they come into view.
+    return scroll_only_ || ScaleAndReleaseSource();
+}
+
+bool ImageLoader::ScaleAndReleaseSource() {
+    if (!ScaleRetained()) return false;
+    if (!keep_source_) {
+        // Nobody is going to ask for a re-layout.
+        delete retained_;
+        retained_ = nullptr;
+        delete direct_source_;
+        direct_source_ = nullptr;
+    }
+    return true;
+}
+
+// If "img" is transparent and should get a background, apply that.
+static bool ApplyBackground(const char *bg_color, const char *pattern_color,
+                            Magick::Image *img) {
+    if (!bg_color && !pattern_color) return true;
+    Magick::Image target;
+    try {
+        RenderBackground(img->columns(), img->rows(),
+                         bg_color, pattern_color, &target);
+    }
+    catch (std::exception& e) {
+        fprintf(stderr, "Trouble rendering background (%s)\n", e.what());
+        return false;
+    }
+    target.composite(*img, 0, 0, Magick::OverCompositeOp);
+    target.animationDelay(img->animationDelay());  // lost otherwise.
+    *img = target;
+    return true;
+}
+
+// Scale "source" to the size of "target" by picking the nearest pixel, as
+// Magick's sample() does.
+static void SampleFramebuffer(const Framebuffer &source, Framebuffer *target) {
+    std::vector<int> source_x(target->width());
+    for (int x = 0; x < target->width(); ++x) {
+        source_x[x] = (int64_t)(2 * x + 1) * source.width()
+            / (2 * target->width());
+    }
+    for (int y = 0; y < target->height(); ++y) {
+        const int sy = (int64_t)(2 * y + 1) * source.height()
+            / (2 * target->height());
+        const Framebuffer::rgb_t *in = source.row(sy);
+        Framebuffer::rgb_t *out = target->row(y);
+        for (int x = 0; x < target->width(); ++x) {
+            out[x] = in[source_x[x]];
+        }
+    }
+}
+
+static uint64_t PixelHash(const Framebuffer &fb) {
+    uint64_t hash = 0xcbf29ce484222325;  // FNV-1a
+    for (int y = 0; y < fb.height(); ++y) {
+        const Framebuffer::rgb_t *pixel = fb.row(y);
+        for (int x = 0; x < fb.width(); ++x) {
+            hash = (hash ^ pixel[x]) * 0x100000001b3;
+        }
+    }
+    return hash;
+}
+
+static bool SamePixels(const Framebuffer &a, const Framebuffer &b) {
+    return a.width() == b.width() && a.height() == b.height()
+        && memcmp(a.row(0), b.row(0),
+                  sizeof(Framebuffer::rgb_t) * a.width() * a.height()) == 0;
+}
+
+void ImageLoader::ShareDuplicateFrames() {
+    std::unordered_multimap<uint64_t, const PreprocessedFrame *> seen;
+    for (size_t i = 0; i < frames_.size(); ++i) {
+        PreprocessedFrame *frame = frames_[i];
+        const uint64_t hash = PixelHash(frame->framebuffer());
+        auto candidates = seen.equal_range(hash);
+        for (auto it = candidates.first; it != candidates.second; ++it) {
+            if (SamePixels(it->second->framebuffer(), frame->framebuffer())) {
+                frame->ShareWith(*it->second);
+                break;
+            }
+        }
+        if (frame->content_id() < 0) {
+            frame->set_content_id(i);
+            seen.insert({hash, frame});
+        }
+    }
+}
+
+bool ImageLoader::ScaleRetained() {
+    for (PreprocessedFrame *f : frames_) delete f;
+    frames_.clear();
+
+    if (frame_deltas_) {
+        if (!ScaleFrameDeltas()) return false;
+        ShareDuplicateFrames();
+        return true;
+    }
+
+    if (direct_source_) {
+        const Framebuffer &source = *direct_source_;
+        int target_width, target_height;
+        ScaleToFit(source.width(), source.height(),
+                   display_width_, display_height_,
+                   options_, &target_width, &target_height);
+        PreprocessedFrame *frame
+            = new PreprocessedFrame(target_width, target_height,
+                                    Duration::Millis(100));
+        if (target_width == source.width()
+            && target_height == source.height()) {
+            frame->mutable_framebuffer()->CopyFrom(source);
+        } else if (!options_.antialias) {
+            SampleFramebuffer(source, frame->mutable_framebuffer());
+        } else {
+            FramebufferScaler(source.width(), source.height(),
+                              target_width, target_height)
+                .Scale(source, frame->mutable_framebuffer());
+        }
+        frames_.push_back(frame);
+        return true;
+    }
+
+    for (const Magick::Image &source : *retained_) {
+        Magick::Image img = source;   // Copy-on-write, so cheap.
+
         // Figure out scaling for the image.
         int target_width = 0, target_height = 0;
-        if (ScaleToFit(img.columns(), img.rows(), display_width, display_height,
-                       display_options, &target_width, &target_height)) {
-            if (display_options.antialias)
+        if (ScaleToFit(img.columns(), img.rows(),
+                       display_width_, display_height_,
+                       options_, &target_width, &target_height)
+            && (target_width != (int)img.columns()
+                || target_height != (int)img.rows())) {
+            if (options_.antialias)
                 img.scale(Magick::Geometry(target_width, target_height));
             else
                 img.sample(Magick::Geometry(target_width, target_height));
         }
 
-        // If these are transparent and should get a background, apply that.
-        if (bg_color || pattern_color) {
-            Magick::Image target;
-            try {
-                RenderBackground(img.columns(), img.rows(),
-                                 bg_color, pattern_color, &target);
+        if (!ApplyBackground(bg_color_, pattern_color_, &img))
+            return false;
+        frames_.push_back(new PreprocessedFrame(img));
+    }
+    if (is_animation_) ShareDuplicateFrames();
+
+    return true;
+}
+
+namespace {
+// GIF disposal methods: what becomes of a frame's region after it is shown.
+enum GIFDisposal {
+    kDisposeBackground = 2,  // Cleared to transparent.
+    kDisposePrevious = 3,    // Restored to what it was before.
+};
+
+// A rectangle in pixels.
+struct Region {
+    int x, y, width, height;
+
+    bool empty() const { return width <= 0 || height <= 0; }
+    Region Union(const Region &other) const {
+        if (empty()) return other;
+        if (other.empty()) return *this;
+        const int x0 = std::min(x, other.x);
+        const int y0 = std::min(y, other.y);
+        return { x0, y0,
+                 std::max(x + width, other.x + other.width) - x0,
+                 std::max(y + height, other.y + other.height) - y0 };
+    }
+};
+}  // namespace
+
+// Where "frame" is placed on a canvas of the given size.
+static Region PlacedRegion(const Magick::Image &frame,
+                           int canvas_width, int canvas_height) {
+    const Magick::Geometry page = frame.page();
+    const int x0 = std::max(0, (int)page.xOff());
+    const int y0 = std::max(0, (int)page.yOff());
+    const int x1 = std::min(canvas_width,
+                            (int)page.xOff() + (int)frame.columns());
+    const int y1 = std::min(canvas_height,
+                            (int)page.yOff() + (int)frame.rows());
+    return { x0, y0, x1 - x0, y1 - y0 };
+}
+
+bool ImageLoader::ScaleFrameDeltas() {
+    const std::vector<Magick::Image> &frames = *retained_;
+    int canvas_width, canvas_height;
+    CanvasSize(frames[0], &canvas_width, &canvas_height);
+    int target_width, target_height;
+    ScaleToFit(canvas_width, canvas_height, display_width_, display_height_,
+               options_, &target_width, &target_height);
+
+    const Magick::Color transparent("transparent");
+    Magick::Image canvas(Magick::Geometry(canvas_width, canvas_height),
+                         transparent);
+    Magick::Image saved;         // What kDisposePrevious restores.
+    Region disposed = { 0, 0, 0, 0 };  // Changed by the previous disposal.
+    const Framebuffer *previous = nullptr;
+    for (const Magick::Image &frame : frames) {
+        const Region placed = PlacedRegion(frame,
+                                           canvas_width, canvas_height);
+        const unsigned int disposal = frame.gifDisposeMethod();
+        if (disposal == kDisposePrevious && !placed.empty()) {
+            saved = canvas;
+            saved.crop(Magick::Geometry(placed.width, placed.height,
+                                        placed.x, placed.y));
+        }
+        canvas.composite(frame, frame.page().xOff(), frame.page().yOff(),
+                         Magick::OverCompositeOp);
+
+        // Target pixels covering what changed, and the source region they
+        // are scaled from in their entirety.
+        const Region changed = previous
+            ? placed.Union(disposed)
+            : Region{ 0, 0, canvas_width, canvas_height };
+        const int tx0 = changed.x * target_width / canvas_width;
+        const int ty0 = changed.y * target_height / canvas_height;
+        const int tx1 = ((changed.x + changed.width) * target_width
+                         + canvas_width - 1) / canvas_width;
+        const int ty1 = ((changed.y + changed.height) * target_height
+                         + canvas_height - 1) / canvas_height;
+        const int sx0 = tx0 * canvas_width / target_width;
+        const int sy0 = ty0 * canvas_height / target_height;
+        const int sx1 = std::min(canvas_width, (tx1 * canvas_width
+                                                + target_width - 1)
+                                 / target_width);
+        const int sy1 = std::min(canvas_height, (ty1 * canvas_height
+                                                 + target_height - 1)
+                                 / target_height);
+
+        PreprocessedFrame *scaled = new PreprocessedFrame(
+            target_width, target_height, DurationFromImgDelay(frame));
+        if (previous) scaled->mutable_framebuffer()->CopyFrom(*previous);
+        if (!changed.empty() && tx1 > tx0 && ty1 > ty0) {
+            Magick::Image region = canvas;   // Copy-on-write, so cheap.
+            region.crop(Magick::Geometry(sx1 - sx0, sy1 - sy0, sx0, sy0));
+            if (tx1 - tx0 != sx1 - sx0 || ty1 - ty0 != sy1 - sy0) {
+                // Exactly the target pixels, not what the aspect ratio of
+                // the region suggests.
+                Magick::Geometry size(tx1 - tx0, ty1 - ty0);
+                size.aspect(true);
+                if (options_.antialias)
+                    region.scale(size);
+                else
+                    region.sample(size);
             }
-            catch (std::exception& e) {
-                fprintf(stderr, "Trouble rendering background (%s)\n",
-                        e.what());
+            if (!ApplyBackground(bg_color_, nullptr, &region)) {
+                delete scaled;
                 return false;
             }
-            target.composite(img, 0, 0, Magick::OverCompositeOp);
-            target.animationDelay(img.animationDelay());  // lost otherwise.
-            img = target;
+            CopyRegionToFramebuffer(region, tx0, ty0,
+                                    scaled->mutable_framebuffer());
         }
-        frames_.push_back(new PreprocessedFrame(img));
-    }
+        frames_.push_back(scaled);
+        previous = &scaled->framebuffer();
 
+        // Prepare the canvas for the next frame.
+        disposed = { 0, 0, 0, 0 };
+        if (placed.empty()) continue;
+        if (disposal == kDisposeBackground) {
+            canvas.composite(Magick::Image(Magick::Geometry(placed.width,
+                                                            placed.height),
+                                           transparent),
+                             placed.x, placed.y, Magick::CopyCompositeOp);
+            disposed = placed;
+        } else if (disposal == kDisposePrevious) {
+            canvas.composite(saved, placed.x, placed.y,
+                             Magick::CopyCompositeOp);
+            disposed = placed;
+        }
+    }
     return true;
 }
 
-int ImageLoader::IndentationIfCentered(const PreprocessedFrame *frame) const {
-    return center_horizontally_
-        ? (display_width_ - frame->framebuffer().width()) / 2
-        : 0;
+bool ImageLoader::Rescale(int display_width, int display_height) {
+    if (!retained_ && !direct_source_) return false;
+    if (display_width == display_width_ && display_height == display_height_)
+        return false;
+    display_width_ = display_width;
+    display_height_ = display_height;
+    return scroll_only_ || ScaleRetained();
+}
+
+const Framebuffer &ImageLoader::framebuffer(int n) const {
+    return frames_[n]->framebuffer();
+}
+
+Duration ImageLoader::frame_delay(int n) const {
+    return frames_[n]->delay();
 }
 
+int ImageLoader::frame_content_id(int n) const {
+    return frames_[n]->content_id();
+}
+
+size_t ImageLoader::memory_used() const {
+    size_t result = 0;
+    for (const PreprocessedFrame *f : frames_) {
+        if (f->content_id() >= 0 && frames_[f->content_id()] != f)
+            continue;  // Shares the framebuffer of an earlier frame.
+        result += sizeof(Framebuffer::rgb_t)
+            * f->framebuffer().width() * f->framebuffer().height();
+    }
+    if (retained_) {
+        for (const Magick::Image &img : *retained_) {
+            result += sizeof(Magick::PixelPacket) * img.columns() * img.rows();
+        }
+    }
+    if (direct_source_) {
+        result += sizeof(Framebuffer::rgb_t)
+            * direct_source_->width() * direct_source_->height();
+    }
+    return result;
+}
+
+int ImageLoader::indentation(int frame_width) const {
+    return center_horizontally_ ? (display_width_ - frame_width) / 2 : 0;
+}
+
+// Upper limit of encoded frame transitions PlayFrames() keeps to replay.
+static constexpr size_t kEncodedCacheBytes = 16 << 20;
+
+// Frames to skip in animations or scroll steps when seeking.
+static constexpr int kSeekSteps = 10;
+
 void ImageLoader::Display(Duration duration, int max_frames, int loops,
-                          const volatile sig_atomic_t &interrupt_received,
+                          timg::EventLoop *event_loop,
                           timg::TerminalCanvas *canvas) {
+    PlayFrames(this, duration, max_frames, loops, event_loop, canvas);
+}
+
+void ImageLoader::DisplayOver(const Framebuffer &preview,
+                              timg::TerminalCanvas *canvas) {
+    const Framebuffer &frame = framebuffer(0);
+    canvas->JumpUpPixels(preview.height());
+    if (frame.width() == preview.width()
+        && frame.height() == preview.height()) {
+        canvas->SendDifference(frame, preview, indentation(frame.width()));
+    } else {
+        // Rounded differently, e.g. decoded for a retain size; nothing of
+        // the preview may stay around the image.
+        canvas->ClearBelow();
+        canvas->Send(frame, indentation(frame.width()));
+    }
+}
+
+std::unique_ptr<Framebuffer> LoadFirstFrame(const char *filename,
+                                            int display_width,
+                                            int display_height,
+                                            const DisplayOptions &options,
+                                            const char *bg_color,
+                                            const char *pattern_color) {
+    ImageLoader loader;
+    // Of animations, don't decode and put together frames never shown.
+    loader.SetPlaybackLimits(1, Duration::InfiniteFuture());
+    if (!loader.LoadAndScale(filename, display_width, display_height,
+                             options, bg_color, pattern_color)) {
+        return nullptr;
+    }
+    const Framebuffer &frame = loader.framebuffer(0);
+    std::unique_ptr<Framebuffer> result(
+        new Framebuffer(frame.width(), frame.height()));
+    result->CopyFrom(frame);
+    return result;
+}
+
+void PlayFrames(FrameSource *source,
+                Duration duration, int max_frames, int loops,
+                timg::EventLoop *event_loop,
+                timg::TerminalCanvas *canvas) {
+    const int frame_count = source->frame_count();
     if (max_frames == -1) {
-        max_frames = (int)frames_.size();
+        max_frames = frame_count;
     } else {
-        max_frames = std::min(max_frames, (int)frames_.size());
+        max_frames = std::min(max_frames, frame_count);
     }
+    if (max_frames <= 0) return;
+    event_loop->StartPlayback();
 
+    const bool is_animation = source->is_animation();
     const Time end_time = Time::Now() + duration;
     int last_height = -1;  // First one will not have a height.
-    if (frames_.size() == 1 || !is_animation_)
+    std::unique_ptr<Framebuffer> shown;  // Copy of the frame shown last.
+    int shown_id = -1;                   // Its content id, if known.
+
+    // Encoded output going from one frame content to another (or from
+    // nothing, -1), to be sent again when it comes up again, e.g. in the
+    // next loop.
+    std::map<std::pair<int, int>, std::string> encoded;
+    size_t encoded_bytes = 0;
+    if (frame_count == 1 || !is_animation)
         loops = 1;   // If there is no animation, nothing to repeat.
+    int frame_pos = 0;
     for (int k = 0;
          (loops < 0 || k < loops)
-             && !interrupt_received
+             && !event_loop->interrupted()
              && Time::Now() < end_time;
-         ++k) {
-        for (const auto &frame : frames_) {
-            const Time frame_start = Time::Now();
-            if (interrupt_received || frame_start >= end_time)
-                break;
-            if (is_animation_ && last_height > 0) {
+         /**/) {
+        // A frame identical to the one shown just keeps that one up for
+        // its delay as well, so runs of duplicates are one longer frame.
+        const int content_id = is_animation
+            ? source->frame_content_id(frame_pos) : -1;
+        const bool already_shown = (content_id >= 0 && last_height > 0
+                                    && content_id == shown_id);
+        const Framebuffer *frame = already_shown
+            ? nullptr : source->GetFrame(frame_pos);
+        if (!frame && !is_animation) return;  // Document ended early.
+        const Time frame_start = Time::Now();
+        if (frame) {
+            const int indent = source->indentation(frame->width());
+            // Only update the cells that changed since the last frame.
+            const bool in_place = is_animation && last_height > 0
+                && shown && shown->width() == frame->width()
+                && shown->height() == frame->height();
+            if (is_animation && last_height > 0) {
                 canvas->JumpUpPixels(last_height);
             }
-            canvas->Send(frame->framebuffer(), IndentationIfCentered(frame));
-            last_height = frame->framebuffer().height();
-            const Time frame_finish = frame_start + frame->delay();
-            frame_finish.WaitUntil();
+            if (content_id >= 0) {
+                const std::pair<int, int> key(in_place ? shown_id : -1,
+                                              content_id);
+                auto found = encoded.find(key);
+                if (found != encoded.end()) {
+                    canvas->SendEncoded(found->second.data(),
+                                        found->second.size());
+                } else {
+                    size_t len;
+                    const char *data = in_place
+                        ? canvas->EncodeDifference(*frame, *shown, indent,
+                                                   &len)
+                        : canvas->Encode(*frame, indent, &len);
+                    canvas->SendEncoded(data, len);
+                    if (encoded_bytes + len <= kEncodedCacheBytes) {
+                        encoded[key].assign(data, len);
+                        encoded_bytes += len;
+                    }
+                }
+            } else if (in_place) {
+                canvas->SendDifference(*frame, *shown, indent);
+            } else {
+                canvas->Send(*frame, indent);
+            }
+            last_height = frame->height();
+            shown_id = content_id;
+            if (is_animation) {
+                // Frames only stay valid until the next one is requested.
+                if (!shown || shown->width() != frame->width()
+                    || shown->height() != frame->height()) {
+                    shown.reset(new Framebuffer(frame->width(),
+                                                frame->height()));
+                }
+                shown->CopyFrom(*frame);
+            }
+        }
+
+        // Stepping back is only possible if we show frames in-place.
+        int advance = 1;
+        switch (event_loop->WaitForNextFrame(
+                    frame_start + source->frame_delay(frame_pos))) {
+        case EventLoop::Command::kQuit:
+        case EventLoop::Command::kExitKey:
+            return;
+        case EventLoop::Command::kStepBackward:
+            advance = is_animation ? -1 : 1;
+            break;
+        case EventLoop::Command::kSeekForward:
+            advance = is_animation ? kSeekSteps : 1;
+            break;
+        case EventLoop::Command::kSeekBackward:
+            advance = is_animation ? -kSeekSteps : 1;
+            break;
+        case EventLoop::Command::kResize:
+            if (source->Rescale(event_loop->terminal_pixel_width(),
+                                event_loop->terminal_pixel_height())) {
+                // Old output is garbled by the terminal re-flowing lines.
+                canvas->ClearScreen();
+                last_height = -1;
+                encoded.clear();  // Frames and indentation changed.
+                encoded_bytes = 0;
+                advance = 0;   // Show current frame again in new size.
+            }
+            break;
+        default:
+            break;
+        }
+        frame_pos += advance;
+        if (frame_pos >= max_frames) {
+            frame_pos = 0;
+            ++k;
+        } else if (frame_pos < 0) {
+            frame_pos = max_frames - 1;
         }
     }
 }
 
 static int gcd(int a, int b) { return b == 0 ? a : gcd(b, a % b); }
 
+// Rows of a scaled image for scrolling, prepared in horizontal bands as
+// they are needed instead of all at once, so that scrolling through very
+// long images starts right away. Bands coming into view next are prepared
+// on a worker thread ahead of time.
+class ImageLoader::ScrollBands {
+public:
+    ScrollBands(const Magick::Image &source, int width, int height,
+                bool antialias, const char *bg_color,
+                const char *pattern_color)
+        : source_(source), width_(width), height_(height),
+          antialias_(antialias),
+          bg_color_(bg_color), pattern_color_(pattern_color), pool_(1) {}
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // Row "y" of the scaled image; prepared now if not done already.
+    const Framebuffer::rgb_t *row(int y) {
+        Request(y / kBandHeight);
+        const Framebuffer *band = bands_[y / kBandHeight].get().get();
+        return band->row(y % kBandHeight);
+    }
+
+    // Rows "first" to "last" (possibly wrapping around) are shown now and
+    // we move in "direction": prepare the next band in that direction,
+    // forget about the bands we won't need soon.
+    void Advance(int first, int last, int direction) {
+        const int band_count = (height_ + kBandHeight - 1) / kBandHeight;
+        const int first_band = first / kBandHeight;
+        int wanted = (last / kBandHeight - first_band + band_count)
+            % band_count + 1;
+        if (direction != 0) {
+            ++wanted;
+            Request((direction > 0)
+                    ? (first_band + wanted - 1) % band_count
+                    : (first_band - 1 + band_count) % band_count);
+        }
+        for (auto it = bands_.begin(); it != bands_.end(); /**/) {
+            // Distance from the visible ones in the direction we move.
+            const int ahead = (direction >= 0)
+                ? (it->first - first_band + band_count) % band_count
+                : (it->first - first_band + 1 + band_count) % band_count;
+            if (ahead < wanted) {
+                ++it;
+            } else {
+                it = bands_.erase(it);
+            }
+        }
+    }
+
+private:
+    // Even, so that the checkerboard background continues across bands.
+    static constexpr int kBandHeight = 128;
+    typedef std::shared_ptr<Framebuffer> Band;
+
+    void Request(int band) {
+        if (bands_.find(band) != bands_.end()) return;
+        bands_[band] = pool_.ExecAsync([this, band]() {
+                return CreateBand(band);
+            }).share();
+    }
+
+    Band CreateBand(int band) const {
+        const int y_start = band * kBandHeight;
+        const int height = std::min(kBandHeight, height_ - y_start);
+        const int src_height = source_.rows();
+        const int src_start = (int64_t)y_start * src_height / height_;
+        const int src_end = std::max(
+            src_start + 1,
+            (int)((int64_t)(y_start + height) * src_height / height_));
+        Magick::Image img = source_;
+        img.crop(Magick::Geometry(source_.columns(), src_end - src_start,
+                                  0, src_start));
+        if ((int)img.columns() != width_ || (int)img.rows() != height) {
+            Magick::Geometry size(width_, height);
+            size.aspect(true);  // Slight rounding differences are ok.
+            if (antialias_)
+                img.scale(size);
+            else
+                img.sample(size);
+        }
+        Band result(new Framebuffer(width_, kBandHeight));
+        if (ApplyBackground(bg_color_, pattern_color_, &img)) {
+            CopyToFramebuffer(img, result.get());
+        }
+        return result;
+    }
+
+    const Magick::Image source_;
+    const int width_;
+    const int height_;
+    const bool antialias_;
+    const char *const bg_color_;
+    const char *const pattern_color_;
+    ThreadPool pool_;
+    std::map<int, std::shared_future<Band>> bands_;
+};
+
+void ImageLoader::SetContent(std::shared_ptr<const FileContent> content) {
+    content_ = content;
+}
+
+void ImageLoader::PrepareForScrolling() {
+    scroll_only_ = true;
+}
+
+void ImageLoader::KeepSourceForRescale() {
+    keep_source_ = true;
+}
+
 void ImageLoader::Scroll(Duration duration, int loops,
-                         const volatile sig_atomic_t &interrupt_received,
+                         timg::EventLoop *event_loop,
                          int dx, int dy, Duration scroll_delay,
                          timg::TerminalCanvas *canvas) {
-    if (frames_.size() > 1) {
+    if (!retained_ || retained_->empty()) return;
+    if (retained_->size() > 1) {
         fprintf(stderr, "This is an %simage format, "
                 "scrolling on top of that is not supported. "
                 "Just doing the scrolling of the first frame.\n",
@@ -290,9 +1179,14 @@ void ImageLoader::Scroll(Duration duration, int loops,
         // TODO: do both.
     }
 
-    const Framebuffer &img = frames_[0]->framebuffer();
-    const int img_width = img.width();
-    const int img_height = img.height();
+    const Magick::Image &source = (*retained_)[0];
+    int img_width = source.columns();
+    int img_height = source.rows();
+    ScaleToFit(source.columns(), source.rows(),
+               display_width_, display_height_, options_,
+               &img_width, &img_height);
+    ScrollBands bands(source, img_width, img_height, options_.antialias,
+                      bg_color_, pattern_color_);
 
     const int display_w = std::min(display_width_, img_width);
     const int display_h = std::min(display_height_, img_height);
@@ -320,32 +1214,70 @@ void ImageLoader::Scroll(Duration duration, int loops,
     bool is_first = true;
 
     timg::Framebuffer display_fb(display_w, display_h);
+    event_loop->StartPlayback();
     const Time end_time = Time::Now() + duration;
+    int64_t cycle_pos = 0;
     for (int k = 0;
          (loops < 0 || k < loops)
-             && !interrupt_received
+             && !event_loop->interrupted()
              && Time::Now() < end_time;
-         ++k) {
-        for (int64_t cycle_pos = 0; cycle_pos <= cycle_steps; ++cycle_pos) {
-            const Time frame_start = Time::Now();
-            if (interrupt_received || frame_start >= end_time)
-                break;
-            const int64_t x_cycle_pos = dx*cycle_pos;
-            const int64_t y_cycle_pos = dy*cycle_pos;
-            for (int y = 0; y < display_h; ++y) {
-                for (int x = 0; x < display_w; ++x) {
-                    const int x_src = (x_init + x_cycle_pos + x) % img_width;
-                    const int y_src = (y_init + y_cycle_pos + y) % img_height;
-                    display_fb.SetPixel(x, y, img.at(x_src, y_src));
-                }
+         /**/) {
+        const Time frame_start = Time::Now();
+        const int64_t x_cycle_pos = dx*cycle_pos;
+        const int64_t y_cycle_pos = dy*cycle_pos;
+        for (int y = 0; y < display_h; ++y) {
+            const int y_src = (y_init + y_cycle_pos + y) % img_height;
+            const Framebuffer::rgb_t *src_row = bands.row(y_src);
+            for (int x = 0; x < display_w; ++x) {
+                const int x_src = (x_init + x_cycle_pos + x) % img_width;
+                display_fb.SetPixel(x, y, src_row[x_src]);
             }
-            if (!is_first) {
-                canvas->JumpUpPixels(display_fb.height());
+        }
+        bands.Advance((y_init + y_cycle_pos) % img_height,
+                      (y_init + y_cycle_pos + display_h - 1) % img_height,
+                      dy);
+        if (!is_first) {
+            canvas->JumpUpPixels(display_fb.height());
+        }
+        canvas->Send(display_fb, 0);
+        is_first = false;
+
+        switch (event_loop->WaitForNextFrame(frame_start + scroll_delay)) {
+        case EventLoop::Command::kQuit:
+        case EventLoop::Command::kExitKey:
+            return;
+        case EventLoop::Command::kStepBackward:
+            cycle_pos -= 1;
+            break;
+        case EventLoop::Command::kSeekForward:
+            cycle_pos += kSeekSteps;
+            break;
+        case EventLoop::Command::kSeekBackward:
+            cycle_pos -= kSeekSteps;
+            break;
+        case EventLoop::Command::kResize:
+            if (Rescale(event_loop->terminal_pixel_width(),
+                        event_loop->terminal_pixel_height())) {
+                // All the geometry depends on the size, so start over with
+                // what is left.
+                canvas->ClearScreen();
+                const Duration remaining = Duration::Nanos(
+                    end_time.nanoseconds() - Time::Now().nanoseconds());
+                Scroll(remaining, loops < 0 ? loops : loops - k,
+                       event_loop, dx, dy, scroll_delay, canvas);
+                return;
             }
-            canvas->Send(display_fb, 0);
-            is_first = false;
-            const Time frame_finish = frame_start + scroll_delay;
-            frame_finish.WaitUntil();
+            cycle_pos += 1;
+            break;
+        default:
+            cycle_pos += 1;
+            break;
+        }
+        if (cycle_pos > cycle_steps) {
+            cycle_pos = 0;
+            ++k;
+        } else if (cycle_pos < 0) {
+            cycle_pos = cycle_steps;
         }
     }
 }
@@ -16,13 +16,20 @@
 #ifndef IMAGE_DISPLAY_H_
 #define IMAGE_DISPLAY_H_
 
+#include <memory>
 #include <vector>
-#include <signal.h>
 
 #include "timg-time.h"
 #include "terminal-canvas.h"
 
+namespace Magick {
+class Image;
+}
+
 namespace timg {
+class EventLoop;
+class FileContent;
+
 struct DisplayOptions {
     // If image is smaller than screen, only upscale if do_upscale is set.
     bool upscale = false;
@@ -43,7 +50,66 @@ bool ScaleToFit(int img_width, int img_height,
                 const DisplayOptions &options,
                 int *target_width, int *target_height);
 
-class ImageLoader {
+// Copy image into framebuffer, which needs to be at least the size of
+// the image. Fully transparent pixels are left untouched.
+void CopyToFramebuffer(const Magick::Image &img, timg::Framebuffer *result);
+
+// A sequence of frames to be shown with PlayFrames(), such as the frames
+// of an animation. Frames are requested in the order they are shown, so
+// implementations can prepare them lazily.
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    // Number of frames. Sources that are no animation and only learn how
+    // many frames they have while going might return an upper bound.
+    virtual int frame_count() const = 0;
+
+    // Frame "n" ready to be sent; stays valid until the next call. Returns
+    // nullptr if it can't be provided, which, if this is no animation,
+    // ends the sequence.
+    virtual const Framebuffer *GetFrame(int n) = 0;
+    virtual Duration frame_delay(int n) const = 0;
+
+    // Frames with the same non-negative content id have identical pixels;
+    // a frame repeating the one before is then not sent again, and what
+    // was encoded for a frame is reused. Negative if not known.
+    virtual int frame_content_id(int n) const { return -1; }
+
+    // Horizontal indentation of a frame with the given width.
+    virtual int indentation(int frame_width) const = 0;
+
+    // Animation frames replace each other in place and can be stepped
+    // through, otherwise frames are shown one below the other.
+    virtual bool is_animation() const = 0;
+
+    // Re-layout for a new display size, e.g. after the terminal has been
+    // resized. Returns false if nothing changed.
+    virtual bool Rescale(int display_width, int display_height) = 0;
+};
+
+// Show frames of "source". If this is an animation, then "duration",
+// "max_frames" and "loops" will limit the duration of the display.
+// "max_frames" and "loops" with negative values mean infinite.
+//
+// Frame timing, interrupts and user interaction (pause, step, seek)
+// are handled by the "event_loop".
+void PlayFrames(FrameSource *source,
+                Duration duration, int max_frames, int loops,
+                EventLoop *event_loop, TerminalCanvas *canvas);
+
+// Load "filename" like ImageLoader::LoadAndScale() does, but only its
+// first frame, and return a copy of that. The loader with its decoded
+// source is released right away, so only the small frame is held on to,
+// e.g. for thumbnails. Returns nullptr if it can't be loaded.
+std::unique_ptr<Framebuffer> LoadFirstFrame(const char *filename,
+                                            int display_width,
+                                            int display_height,
+                                            const DisplayOptions &options,
+                                            const char *bg_color,
+                                            const char *pattern_color);
+
+class ImageLoader : public FrameSource {
 public:
     ~ImageLoader();
 
@@ -53,7 +119,7 @@ public:
     // Images are processed to fit in the given "display_width"x"display_height"
     // using ScaleOptions.
     // Transparent images are preprocessed with background and pattern_color
-    // if set.
+    // if set; these strings need to outlive the ImageLoader.
     // If this is not a loadable image, returns false, otherwise
     // We're ready for display.
     bool LoadAndScale(const char *filename,
@@ -61,35 +127,105 @@ public:
                       const DisplayOptions &options,
                       const char *bg_color, const char *pattern_color);
 
-    // Display loaded image. If this is an animation, then
-    // "duration", "max_frames" and "loops" will limit the duration of the
-    // display. "max_frames" and "loops" with negative values mean infinite.
-    //
-    // The reference to the "interrupt_received" can be updated by a signal
-    // while the method is running and shall be checked often.
+    // Only prepare what Display() will show with these "max_frames" and
+    // "duration" limits (negative "max_frames": no limit). Call before
+    // LoadAndScale(): only the first "max_frames" are read from the file
+    // and animations are only put together up to the frame reaching
+    // "duration".
+    void SetPlaybackLimits(int max_frames, Duration duration);
+
+    // Re-layout the loaded image for a new display size, e.g. after the
+    // terminal has been resized. Scales from the source image retained at
+    // load time without decoding it again; only possible after
+    // KeepSourceForRescale() or PrepareForScrolling().
+    // Returns false if nothing changed.
+    bool Rescale(int display_width, int display_height) override;
+
+    // Display loaded image with PlayFrames().
     void Display(Duration duration, int max_frames, int loops,
-                 const volatile sig_atomic_t &interrupt_received,
+                 timg::EventLoop *event_loop,
                  timg::TerminalCanvas *canvas);
 
+    // Replace "preview", which has been the last thing sent to the canvas,
+    // with the loaded still image. Only the character cells that differ are
+    // sent, so a preview of the same size is refined in place. If the image
+    // came out in a different size, the preview is cleared first.
+    void DisplayOver(const Framebuffer &preview, timg::TerminalCanvas *canvas);
+
+    // Decode from "content", e.g. read ahead by the FilePrefetcher,
+    // instead of reading the file. Call before LoadAndScale().
+    void SetContent(std::shared_ptr<const FileContent> content);
+
+    // Call before LoadAndScale() if the image is only going to be shown
+    // with Scroll(): it then scales the image in bands as they come into
+    // view instead of preparing the whole image at load time.
+    void PrepareForScrolling();
+
+    // Call before LoadAndScale() if the display size can change, e.g. the
+    // terminal size is tracked, so that Rescale() has the source to work
+    // with. Otherwise, it is released once the frames are prepared.
+    void KeepSourceForRescale();
+
     // Provide image scrolling in dx/dy direction for up to the given time.
     void Scroll(Duration duration, int loops,
-                const volatile sig_atomic_t &interrupt_received,
+                timg::EventLoop *event_loop,
                 int dx, int dy,  Duration scroll_delay,
                 timg::TerminalCanvas *canvas);
 
-    bool is_animation() const { return is_animation_; }
+    bool is_animation() const override { return is_animation_; }
+
+    // Access to the loaded frames, e.g. to compose them elsewhere.
+    int frame_count() const override { return (int)frames_.size(); }
+    const Framebuffer &framebuffer(int n) const;
+    Duration frame_delay(int n) const override;
+    int frame_content_id(int n) const override;
+
+    const Framebuffer *GetFrame(int n) override { return &framebuffer(n); }
+    int indentation(int frame_width) const override;
+
+    // Approximate memory in bytes held by the loaded, scaled frames and the
+    // retained source.
+    size_t memory_used() const;
 
 private:
     class PreprocessedFrame;
+    class ScrollBands;
+
+    // Create the frames_ to show from the retained_ source images or the
+    // direct_source_.
+    bool ScaleRetained();
+
+    // ScaleRetained(), then release the source unless we keep it.
+    bool ScaleAndReleaseSource();
+
+    // Create the frames_ of an animation retained as frames the way they
+    // are stored in the file, typically only the region that changed from
+    // the previous frame. They are put together at source resolution, as
+    // coalesceImages() does, but only the changed region is scaled and put
+    // on top of a copy of the previous scaled frame.
+    bool ScaleFrameDeltas();
 
-    // Return how much we should indent a frame if centering is requested.
-    int IndentationIfCentered(const PreprocessedFrame *frame) const;
+    // Let frames_ with identical pixels, such as pauses made of repeated
+    // frames or the way back of ping-pong animations, share a framebuffer
+    // and content id.
+    void ShareDuplicateFrames();
 
     int display_width_;
     int display_height_;
+    DisplayOptions options_;
+    const char *bg_color_ = nullptr;
+    const char *pattern_color_ = nullptr;
+    int max_frames_ = -1;
+    Duration max_duration_ = Duration::InfiniteFuture();
+    std::vector<Magick::Image> *retained_ = nullptr;  // Unscaled source.
+    Framebuffer *direct_source_ = nullptr;  // Source not decoded by Magick.
     std::vector<PreprocessedFrame *> frames_;
     bool is_animation_ = false;
+    bool frame_deltas_ = false;  // retained_ are frames not coalesced.
     bool center_horizontally_ = false;
+    bool scroll_only_ = false;
+    bool keep_source_ = false;
+    std::shared_ptr<const FileContent> content_;
 };
 
 }  // namespace timg
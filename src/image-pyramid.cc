@@ -0,0 +1,136 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "image-pyramid.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <future>
+
+#include "thread-pool.h"
+
+namespace timg {
+typedef Framebuffer::rgb_t rgb_t;
+
+// Smallest level we bother to create; no terminal is smaller than that.
+static constexpr int kSmallestLevel = 16;
+
+// Average four pixels. Red and blue are summed up in one go, as
+// 4 * 255 still fits in the eight bits of space between them.
+static inline rgb_t Average4(rgb_t a, rgb_t b, rgb_t c, rgb_t d) {
+    const uint32_t rb = (((a & 0xff00ff) + (b & 0xff00ff)
+                          + (c & 0xff00ff) + (d & 0xff00ff)
+                          + 0x020002) >> 2) & 0xff00ff;
+    const uint32_t g = (((a & 0x00ff00) + (b & 0x00ff00)
+                         + (c & 0x00ff00) + (d & 0x00ff00)
+                         + 0x000200) >> 2) & 0x00ff00;
+    return rb | g;
+}
+
+// Create rows [y_start, y_end) of "dst" from the double resolution "src".
+static void Downsample(const Framebuffer &src, int y_start, int y_end,
+                       Framebuffer *dst) {
+    const int last_x = src.width() - 1;
+    const int last_y = src.height() - 1;
+    for (int y = y_start; y < y_end; ++y) {
+        const rgb_t *top = src.row(std::min(2*y, last_y));
+        const rgb_t *bottom = src.row(std::min(2*y + 1, last_y));
+        rgb_t *out = dst->row(y);
+        for (int x = 0; x < dst->width(); ++x) {
+            const int x0 = std::min(2*x, last_x);
+            const int x1 = std::min(2*x + 1, last_x);
+            out[x] = Average4(top[x0], top[x1], bottom[x0], bottom[x1]);
+        }
+    }
+}
+
+ImagePyramid::ImagePyramid(Framebuffer *source, ThreadPool *pool) {
+    levels_.push_back(source);
+    const Framebuffer *previous = source;
+    while (previous->width() > kSmallestLevel
+           || previous->height() > kSmallestLevel) {
+        Framebuffer *level = new Framebuffer((previous->width() + 1) / 2,
+                                             (previous->height() + 1) / 2);
+        // Each level depends on the previous one, but within a level, we
+        // can work on bands of rows in parallel.
+        const int bands = 4 * pool->size();
+        const int band_height = (level->height() + bands - 1) / bands;
+        std::vector<std::future<void>> work;
+        for (int y = 0; y < level->height(); y += band_height) {
+            const int y_end = std::min(y + band_height, level->height());
+            work.push_back(pool->ExecAsync([previous, y, y_end, level]() {
+                        Downsample(*previous, y, y_end, level);
+                    }));
+        }
+        for (std::future<void> &w : work) w.get();
+        levels_.push_back(level);
+        previous = level;
+    }
+}
+
+ImagePyramid::~ImagePyramid() {
+    for (Framebuffer *level : levels_) delete level;
+}
+
+// Bilinear interpolation between two pixels with weight "w" (0..256) on b.
+static inline rgb_t Mix(rgb_t a, rgb_t b, uint32_t w) {
+    const uint32_t rb = ((a & 0xff00ff) * (256 - w)
+                         + (b & 0xff00ff) * w) >> 8;
+    const uint32_t g = ((a & 0x00ff00) * (256 - w)
+                        + (b & 0x00ff00) * w) >> 8;
+    return (rb & 0xff00ff) | (g & 0x00ff00);
+}
+
+void ImagePyramid::Render(double x, double y, double scale,
+                          Framebuffer *out) const {
+    // Use the smallest level that still has at least the output resolution.
+    int n = 0;
+    while (n + 1 < level_count() && (2 << n) <= scale) ++n;
+    const Framebuffer &src = level(n);
+    const double level_scale = scale / (1 << n);
+    const double level_x = x / (1 << n);
+    const double level_y = y / (1 << n);
+    const int last_x = src.width() - 1;
+    const int last_y = src.height() - 1;
+
+    for (int oy = 0; oy < out->height(); ++oy) {
+        rgb_t *out_row = out->row(oy);
+        const double sy = level_y + (oy + 0.5) * level_scale - 0.5;
+        if (sy < -0.5 || sy > last_y + 0.5) {
+            std::fill(out_row, out_row + out->width(), 0);
+            continue;
+        }
+        const int y0 = std::max(0, std::min((int)floor(sy), last_y));
+        const int y1 = std::min(y0 + 1, last_y);
+        const uint32_t wy = std::max(0, std::min(256, (int)((sy - y0) * 256)));
+        const rgb_t *top = src.row(y0);
+        const rgb_t *bottom = src.row(y1);
+        for (int ox = 0; ox < out->width(); ++ox) {
+            const double sx = level_x + (ox + 0.5) * level_scale - 0.5;
+            if (sx < -0.5 || sx > last_x + 0.5) {
+                out_row[ox] = 0;
+                continue;
+            }
+            const int x0 = std::max(0, std::min((int)floor(sx), last_x));
+            const int x1 = std::min(x0 + 1, last_x);
+            const uint32_t wx =
+                std::max(0, std::min(256, (int)((sx - x0) * 256)));
+            out_row[ox] = Mix(Mix(top[x0], top[x1], wx),
+                              Mix(bottom[x0], bottom[x1], wx), wy);
+        }
+    }
+}
+}  // namespace timg
@@ -0,0 +1,55 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef IMAGE_PYRAMID_H_
+#define IMAGE_PYRAMID_H_
+
+#include <vector>
+
+#include "terminal-canvas.h"
+
+namespace timg {
+class ThreadPool;
+
+// Mipmap pyramid of an image. Level 0 is the full resolution source, each
+// following level has half the width and height of the previous one.
+// Rendering an arbitrary region at an arbitrary scale then only needs to
+// look at a level that has about the resolution of the output.
+class ImagePyramid {
+public:
+    // Build the pyramid from "source", taking ownership of it. Levels are
+    // computed in parallel on the given pool.
+    ImagePyramid(Framebuffer *source, ThreadPool *pool);
+    ImagePyramid(const ImagePyramid &) = delete;
+    ~ImagePyramid();
+
+    // Size of the full resolution image.
+    int width() const { return levels_[0]->width(); }
+    int height() const { return levels_[0]->height(); }
+
+    int level_count() const { return (int)levels_.size(); }
+    const Framebuffer &level(int n) const { return *levels_[n]; }
+
+    // Render the region of the image with the top left corner at (x, y) in
+    // full resolution coordinates into "out", with "scale" source pixels per
+    // output pixel. Areas outside the image are black.
+    void Render(double x, double y, double scale, Framebuffer *out) const;
+
+private:
+    std::vector<Framebuffer *> levels_;
+};
+}  // namespace timg
+
+#endif  // IMAGE_PYRAMID_H_
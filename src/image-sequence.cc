@@ -0,0 +1,266 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "image-sequence.h"
+
+#include <ctype.h>
+#include <glob.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "thread-pool.h"
+
+namespace timg {
+// Frames loaded ahead of the one currently shown.
+static constexpr int kReadAhead = 8;
+
+// A filename pattern with a single %d or %0<N>d for the frame number.
+struct NumberPattern {
+    std::string prefix;
+    int width = 0;        // Zero-padded to this many digits.
+    std::string suffix;
+};
+
+// Parse "pattern" into "result". Returns false if it is not a pattern with
+// exactly one number conversion, e.g. a filename that happens to have a
+// '%' in it; the pattern is never given to printf() as format.
+static bool ParseNumberPattern(const char *pattern, NumberPattern *result) {
+    const char *const percent = strchr(pattern, '%');
+    if (!percent || strchr(percent + 1, '%')) return false;
+    const char *pos = percent + 1;
+    int width = 0;
+    if (*pos == '0') {
+        ++pos;
+        if (!isdigit(*pos)) return false;
+        while (isdigit(*pos)) width = 10 * width + (*pos++ - '0');
+        if (width > 64) return false;
+    }
+    if (*pos != 'd') return false;
+    result->prefix.assign(pattern, percent - pattern);
+    result->width = width;
+    result->suffix = pos + 1;
+    return true;
+}
+
+static std::string FormatNumbered(const NumberPattern &pattern, int n) {
+    std::string number = std::to_string(n);
+    if ((int)number.size() < pattern.width)
+        number.insert(0, pattern.width - number.size(), '0');
+    return pattern.prefix + number + pattern.suffix;
+}
+
+bool ExpandImageSequence(const std::vector<const char *> &patterns,
+                         std::vector<std::string> *files) {
+    for (const char *pattern : patterns) {
+        NumberPattern numbered;
+        if (ParseNumberPattern(pattern, &numbered)) {
+            // Sequences typically start at zero or one.
+            int n = (access(FormatNumbered(numbered, 0).c_str(), F_OK) == 0)
+                ? 0 : 1;
+            const size_t before = files->size();
+            for (/**/; ; ++n) {
+                std::string filename = FormatNumbered(numbered, n);
+                if (access(filename.c_str(), F_OK) != 0) break;
+                files->push_back(filename);
+            }
+            if (files->size() == before) {
+                fprintf(stderr, "%s: no numbered files found.\n", pattern);
+                return false;
+            }
+        } else if (strpbrk(pattern, "*?[")) {
+            glob_t matches;
+            if (glob(pattern, 0, nullptr, &matches) != 0) {
+                fprintf(stderr, "%s: no matching files.\n", pattern);
+                return false;
+            }
+            for (size_t i = 0; i < matches.gl_pathc; ++i) {
+                files->push_back(matches.gl_pathv[i]);  // Already sorted.
+            }
+            globfree(&matches);
+        } else {
+            files->push_back(pattern);
+        }
+    }
+    return true;
+}
+
+static PendingFrame LoadOnPool(ThreadPool *pool, const std::string &filename,
+                               int width, int height,
+                               const DisplayOptions &options,
+                               const char *bg_color,
+                               const char *pattern_color) {
+    typedef std::shared_ptr<Framebuffer> Frame;
+    PendingFrame pending;
+    std::shared_ptr<std::atomic<bool>> cancelled
+        = std::make_shared<std::atomic<bool>>(false);
+    // Everything is captured by value: work not started yet might only be
+    // picked up after the requester is gone, then only to notice it is
+    // cancelled.
+    pending.frame = pool->ExecAsync([=]() {
+            if (*cancelled) return Frame();
+            return Frame(LoadFirstFrame(filename.c_str(), width, height,
+                                        options, bg_color, pattern_color));
+        }).share();
+    pending.cancelled = cancelled;
+    return pending;
+}
+
+ImageSequence::ImageSequence(const std::vector<std::string> &files, float fps,
+                             int display_width, int display_height,
+                             const DisplayOptions &options,
+                             const char *bg_color, const char *pattern_color,
+                             ThreadPool *pool)
+    : files_(files),
+      frame_delay_(Duration::Micros((long)(1e6 / (fps > 0 ? fps : 25)))),
+      display_width_(display_width), display_height_(display_height),
+      options_(options), bg_color_(bg_color), pattern_color_(pattern_color),
+      pool_(pool) {
+}
+
+ImageSequence::~ImageSequence() {
+    CancelAll();
+}
+
+void ImageSequence::Schedule(int n) {
+    if (frames_.find(n) != frames_.end()) return;
+    frames_[n] = LoadOnPool(pool_, files_[n], display_width_, display_height_,
+                            options_, bg_color_, pattern_color_);
+}
+
+void ImageSequence::Evict(int n) {
+    const int count = frame_count();
+    for (auto it = frames_.begin(); it != frames_.end(); /**/) {
+        // Distance ahead of "n", wrapping around for the next loop.
+        const int ahead = ((it->first - n) % count + count) % count;
+        if (ahead <= kReadAhead || ahead == count - 1) {  // Keep one back.
+            ++it;
+        } else {
+            *it->second.cancelled = true;
+            it = frames_.erase(it);
+        }
+    }
+}
+
+void ImageSequence::CancelAll() {
+    for (auto &f : frames_) *f.second.cancelled = true;
+    frames_.clear();
+}
+
+const Framebuffer *ImageSequence::GetFrame(int n) {
+    const int count = frame_count();
+    if (n < 0 || n >= count) return nullptr;
+    Evict(n);
+    Schedule(n);
+    for (int i = 1; i <= std::min(kReadAhead, count - 1); ++i) {
+        Schedule((n + i) % count);
+    }
+    current_ = frames_[n].frame.get();
+    if (!current_) {
+        fprintf(stderr, "%s: can't load image.\n", files_[n].c_str());
+    }
+    return current_.get();
+}
+
+int ImageSequence::indentation(int frame_width) const {
+    return options_.center_horizontally
+        ? (display_width_ - frame_width) / 2
+        : 0;
+}
+
+bool ImageSequence::Rescale(int display_width, int display_height) {
+    if (display_width == display_width_ && display_height == display_height_)
+        return false;
+    display_width_ = display_width;
+    display_height_ = display_height;
+    CancelAll();  // Frames of the old size are of no use.
+    return true;
+}
+
+bool PagedDocument::IsPagedDocument(const char *filename) {
+    // Pages are addressed as "filename[<page>]"; this doesn't work with
+    // stdin or with names that already contain such a spec.
+    if (strcmp(filename, "-") == 0 || strchr(filename, '[')) return false;
+    const char *suffix = strrchr(filename, '.');
+    if (!suffix) return false;
+    return strcasecmp(suffix, ".pdf") == 0 || strcasecmp(suffix, ".tif") == 0
+        || strcasecmp(suffix, ".tiff") == 0;
+}
+
+PagedDocument::PagedDocument(int display_width, int display_height,
+                             const DisplayOptions &options,
+                             const char *bg_color, const char *pattern_color,
+                             ThreadPool *pool)
+    : display_width_(display_width), display_height_(display_height),
+      options_(options), bg_color_(bg_color), pattern_color_(pattern_color),
+      pool_(pool), page_count_(INT_MAX) {
+}
+
+PagedDocument::~PagedDocument() {
+    CancelAll();
+}
+
+bool PagedDocument::Load(const char *filename) {
+    filename_ = filename;
+    return GetFrame(0) != nullptr;
+}
+
+void PagedDocument::Schedule(int n) {
+    if (n >= page_count_ || pages_.find(n) != pages_.end()) return;
+    const std::string page = filename_ + "[" + std::to_string(n) + "]";
+    pages_[n] = LoadOnPool(pool_, page, display_width_, display_height_,
+                           options_, bg_color_, pattern_color_);
+}
+
+void PagedDocument::CancelAll() {
+    for (auto &p : pages_) *p.second.cancelled = true;
+    pages_.clear();
+}
+
+const Framebuffer *PagedDocument::GetFrame(int n) {
+    if (n < 0 || n >= page_count_) return nullptr;
+    // Pages are shown front to back; we won't need earlier ones again.
+    pages_.erase(pages_.begin(), pages_.lower_bound(n));
+    Schedule(n);
+    Schedule(n + 1);
+    current_ = pages_[n].frame.get();
+    if (!current_) {
+        // Past the last page (or a broken one, which we can't skip as we
+        // don't know if there is anything after it).
+        page_count_ = n;
+        CancelAll();
+    }
+    return current_.get();
+}
+
+int PagedDocument::indentation(int frame_width) const {
+    return options_.center_horizontally
+        ? (display_width_ - frame_width) / 2
+        : 0;
+}
+
+bool PagedDocument::Rescale(int display_width, int display_height) {
+    if (display_width == display_width_ && display_height == display_height_)
+        return false;
+    display_width_ = display_width;
+    display_height_ = display_height;
+    CancelAll();
+    return true;
+}
+}  // namespace timg
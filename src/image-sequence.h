@@ -0,0 +1,135 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef IMAGE_SEQUENCE_H_
+#define IMAGE_SEQUENCE_H_
+
+#include <atomic>
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "image-display.h"
+
+namespace timg {
+class ThreadPool;
+
+// Expand "patterns" to the list of files of an image sequence. A pattern
+// containing '%' is a printf-style pattern such as "frame-%04d.png",
+// numbered from 0 or 1 up to the first missing file; one with glob
+// characters is expanded to the sorted matching files. Anything else is
+// taken as-is. Returns false if a pattern didn't match any file.
+bool ExpandImageSequence(const std::vector<const char *> &patterns,
+                         std::vector<std::string> *files);
+
+// The first frame of an image file, loaded and scaled on the thread pool.
+// Cancelling skips loading if that has not started yet.
+struct PendingFrame {
+    std::shared_future<std::shared_ptr<Framebuffer>> frame;
+    std::shared_ptr<std::atomic<bool>> cancelled;
+};
+
+// An animation made of numbered image files, shown at a fixed frame rate.
+// Only a few frames around the current one are held in memory: upcoming
+// frames are loaded and scaled on the thread pool while earlier ones are
+// shown.
+class ImageSequence : public FrameSource {
+public:
+    // The "pool" has to outlive this object. "bg_color" and
+    // "pattern_color" as in ImageLoader::LoadAndScale().
+    ImageSequence(const std::vector<std::string> &files, float fps,
+                  int display_width, int display_height,
+                  const DisplayOptions &options,
+                  const char *bg_color, const char *pattern_color,
+                  ThreadPool *pool);
+    ~ImageSequence();
+
+    int frame_count() const override { return (int)files_.size(); }
+    const Framebuffer *GetFrame(int n) override;
+    Duration frame_delay(int n) const override { return frame_delay_; }
+    int indentation(int frame_width) const override;
+    bool is_animation() const override { return true; }
+    bool Rescale(int display_width, int display_height) override;
+
+private:
+    // Make sure frame "n" is loaded or on its way.
+    void Schedule(int n);
+
+    // Forget frames outside the window around "n"; the ones not
+    // started yet won't be loaded.
+    void Evict(int n);
+    void CancelAll();
+
+    const std::vector<std::string> files_;
+    const Duration frame_delay_;
+    int display_width_;
+    int display_height_;
+    const DisplayOptions options_;
+    const char *const bg_color_;
+    const char *const pattern_color_;
+    ThreadPool *const pool_;
+
+    std::map<int, PendingFrame> frames_;
+    std::shared_ptr<Framebuffer> current_;  // Returned last by GetFrame().
+};
+
+// Pages of a document, such as a PDF or a multi-page TIFF, loaded one at a
+// time as they are shown; the next page is loaded on the thread pool while
+// the current one is displayed. So the first page shows up right away,
+// regardless of the length of the document. The number of pages is only
+// known once we've gone past the last one.
+class PagedDocument : public FrameSource {
+public:
+    // Is this a document we can show page by page ?
+    static bool IsPagedDocument(const char *filename);
+
+    // Like ImageSequence.
+    PagedDocument(int display_width, int display_height,
+                  const DisplayOptions &options,
+                  const char *bg_color, const char *pattern_color,
+                  ThreadPool *pool);
+    ~PagedDocument();
+
+    // Load the first page of "filename". Returns false if that didn't work.
+    bool Load(const char *filename);
+
+    int frame_count() const override { return page_count_; }
+    const Framebuffer *GetFrame(int n) override;
+    Duration frame_delay(int n) const override { return Duration(); }
+    int indentation(int frame_width) const override;
+    bool is_animation() const override { return false; }
+    bool Rescale(int display_width, int display_height) override;
+
+private:
+    void Schedule(int n);
+    void CancelAll();
+
+    std::string filename_;
+    int display_width_;
+    int display_height_;
+    const DisplayOptions options_;
+    const char *const bg_color_;
+    const char *const pattern_color_;
+    ThreadPool *const pool_;
+
+    int page_count_;  // Upper bound until we found the end.
+    std::map<int, PendingFrame> pages_;
+    std::shared_ptr<Framebuffer> current_;
+};
+}  // namespace timg
+
+#endif  // IMAGE_SEQUENCE_H_
@@ -0,0 +1,285 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+
+#include "image-stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <Magick++.h>
+
+#include "event-loop.h"
+
+namespace timg {
+static constexpr char kJPEGStart[] = "\xff\xd8\xff";
+static constexpr char kPNGSignature[] = "\x89PNG\r\n\x1a\n";
+static constexpr size_t kPNGSignatureLen = sizeof(kPNGSignature) - 1;
+
+// Largest single read; pipes typically don't give us more anyway.
+static constexpr size_t kReadChunk = 1 << 20;
+
+void ImageStreamSplitter::Append(const char *data, size_t len) {
+    buffer_.append(data, len);
+}
+
+bool ImageStreamSplitter::Next(std::string *image) {
+    if (!Scan()) return false;
+    image->assign(buffer_, 0, pos_);
+    buffer_.erase(0, pos_);
+    pos_ = 0;
+    state_ = State::kSearchStart;
+    return true;
+}
+
+bool ImageStreamSplitter::Scan() {
+    for (;;) {
+        const uint8_t *const b = (const uint8_t*) buffer_.data();
+        const size_t size = buffer_.size();
+        switch (state_) {
+        case State::kSearchStart: {
+            const size_t jpeg = buffer_.find(kJPEGStart);
+            const size_t png = buffer_.find(kPNGSignature, 0,
+                                            kPNGSignatureLen);
+            const size_t start = std::min(jpeg, png);
+            if (start == std::string::npos) {
+                // Keep what could be the beginning of a signature.
+                if (size > kPNGSignatureLen)
+                    buffer_.erase(0, size - kPNGSignatureLen);
+                pos_ = 0;
+                return false;
+            }
+            buffer_.erase(0, start);
+            if (jpeg < png) {
+                pos_ = 2;
+                state_ = State::kJPEGMarker;
+            } else {
+                pos_ = kPNGSignatureLen;
+                state_ = State::kPNGChunk;
+            }
+            break;
+        }
+
+        case State::kJPEGMarker: {
+            if (pos_ + 2 > size) return false;
+            if (b[pos_] != 0xff) {   // Corrupt; look for the next image.
+                buffer_.erase(0, 1);
+                state_ = State::kSearchStart;
+                break;
+            }
+            const uint8_t marker = b[pos_ + 1];
+            if (marker == 0xff) {           // Fill byte.
+                pos_ += 1;
+            } else if (marker == 0xd9) {    // End of image.
+                pos_ += 2;
+                return true;
+            } else if (marker == 0xd8 || marker == 0x01 ||
+                       (marker >= 0xd0 && marker <= 0xd7)) {
+                pos_ += 2;                  // Markers without payload.
+            } else {
+                if (pos_ + 4 > size) return false;
+                // Segment with length; skipping it as a whole also skips
+                // thumbnails embedded in EXIF data.
+                const size_t len = (b[pos_ + 2] << 8) | b[pos_ + 3];
+                pos_ += 2 + len;
+                if (marker == 0xda) state_ = State::kJPEGScan;
+            }
+            break;
+        }
+
+        case State::kJPEGScan:
+            // Entropy coded data: continues until a marker that is not a
+            // stuffed 0xff00 or a restart marker.
+            while (pos_ + 2 <= size) {
+                const void *ff = memchr(b + pos_, 0xff, size - pos_ - 1);
+                if (!ff) {
+                    pos_ = size - 1;
+                    return false;
+                }
+                pos_ = (const uint8_t*) ff - b;
+                const uint8_t next = b[pos_ + 1];
+                if (next == 0x00 || (next >= 0xd0 && next <= 0xd7)) {
+                    pos_ += 2;
+                } else if (next == 0xff) {
+                    pos_ += 1;
+                } else {
+                    state_ = State::kJPEGMarker;
+                    break;
+                }
+            }
+            if (state_ == State::kJPEGScan) return false;
+            break;
+
+        case State::kPNGChunk: {
+            if (pos_ + 8 > size) return false;
+            const size_t len = ((size_t)b[pos_] << 24) | (b[pos_ + 1] << 16)
+                | (b[pos_ + 2] << 8) | b[pos_ + 3];
+            const size_t chunk_end = pos_ + 12 + len;  // length, type, crc
+            if (memcmp(b + pos_ + 4, "IEND", 4) == 0) {
+                if (chunk_end > size) return false;
+                pos_ = chunk_end;
+                return true;
+            }
+            pos_ = chunk_end;
+            break;
+        }
+        }
+    }
+}
+
+ImageStreamLoader::ImageStreamLoader() {}
+
+ImageStreamLoader::~ImageStreamLoader() {
+    if (fd_ > STDERR_FILENO) close(fd_);
+}
+
+bool ImageStreamLoader::LoadAndScale(const char *filename,
+                                     int display_width, int display_height,
+                                     const DisplayOptions &options) {
+    fd_ = (strcmp(filename, "-") == 0) ? STDIN_FILENO
+        : open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return false;
+    }
+    display_width_ = display_width;
+    display_height_ = display_height;
+    options_ = options;
+    return true;
+}
+
+bool ImageStreamLoader::ReadAvailable(bool drain) {
+    if (!read_buffer_) read_buffer_.reset(new char[kReadChunk]);
+    char *const buffer = read_buffer_.get();
+    struct pollfd pfd = { fd_, POLLIN, 0 };
+    do {
+        const ssize_t r = read(fd_, buffer, kReadChunk);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        splitter_.Append(buffer, r);
+    } while (drain && poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN));
+    return true;
+}
+
+bool ImageStreamLoader::DecodeAndShow(const std::string &data,
+                                      TerminalCanvas *canvas) {
+    Magick::Image img;
+    try {
+        // A hint for decoders that can decode at reduced size right away,
+        // like JPEG; we don't need more than fits on the terminal.
+        img.size(Magick::Geometry(display_width_, display_height_));
+        img.read(Magick::Blob(data.data(), data.size()));
+    }
+    catch (Magick::Warning &warning) {
+        // Not a problem.
+    }
+    catch (std::exception &e) {
+        fprintf(stderr, "Skipping image from stream: %s\n", e.what());
+        return false;
+    }
+
+    int target_width = 0, target_height = 0;
+    if (ScaleToFit(img.columns(), img.rows(), display_width_, display_height_,
+                   options_, &target_width, &target_height)) {
+        if (options_.antialias)
+            img.scale(Magick::Geometry(target_width, target_height));
+        else
+            img.sample(Magick::Geometry(target_width, target_height));
+    }
+    Framebuffer frame(img.columns(), img.rows());
+    CopyToFramebuffer(img, &frame);
+
+    if (last_height_ > 0 && last_height_ != frame.height()) {
+        canvas->ClearScreen();   // Size changed; don't leave leftovers.
+    } else {
+        canvas->JumpUpPixels(last_height_);
+    }
+    const int indent = options_.center_horizontally
+        ? (display_width_ - frame.width()) / 2
+        : 0;
+    canvas->Send(frame, indent);
+    last_height_ = frame.height();
+    return true;
+}
+
+void ImageStreamLoader::Play(Duration duration, int max_frames,
+                             EventLoop *event_loop, TerminalCanvas *canvas) {
+    // A pipe or FIFO is live: what can't be shown in time is dropped. A
+    // regular file can't be watched, but then we can show every image.
+    const bool live = event_loop->WatchInput(fd_);
+    const Time end_time = Time::Now() + duration;
+    std::string image, newest;
+    int frames_shown = 0;
+    bool end_of_stream = false;
+    bool done = false;
+    // Handle what the event loop reports; returns true if we are done.
+    auto handle_event = [&](EventLoop::Event event) {
+        switch (event) {
+        case EventLoop::Event::kInput:
+            if (event_loop->input_fd() == fd_)
+                end_of_stream = !ReadAvailable(true);
+            break;
+        case EventLoop::Event::kInterrupt:
+            return true;
+        case EventLoop::Event::kDeadline:
+            return !(Time::Now() < end_time);
+        case EventLoop::Event::kKey:
+            return event_loop->key() == 'q';
+        case EventLoop::Event::kResize:
+            display_width_ = event_loop->terminal_pixel_width();
+            display_height_ = event_loop->terminal_pixel_height();
+            canvas->ClearScreen();
+            last_height_ = 0;
+            break;
+        case EventLoop::Event::kWakeup:
+            break;
+        }
+        return false;
+    };
+    while (!done && (max_frames < 0 || frames_shown < max_frames)) {
+        bool have_image = false;
+        if (live) {
+            while (splitter_.Next(&image)) {
+                newest.swap(image);
+                have_image = true;
+            }
+        } else {
+            have_image = splitter_.Next(&newest);
+        }
+        if (have_image) {
+            if (DecodeAndShow(newest, canvas)) ++frames_shown;
+            done = event_loop->interrupted() || !(Time::Now() < end_time);
+            if (!live && !done) {
+                // Reading a file never waits for the event loop; still
+                // look for signals and keys once per image.
+                done = handle_event(event_loop->WaitUntil(Time::Now()));
+            }
+            continue;
+        }
+        if (end_of_stream) break;
+        if (!live) {
+            end_of_stream = !ReadAvailable(false);
+            continue;
+        }
+
+        done = handle_event(event_loop->WaitUntil(end_time));
+    }
+    if (live) event_loop->UnwatchInput(fd_);
+}
+}  // namespace timg
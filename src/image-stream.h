@@ -0,0 +1,94 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+
+#ifndef IMAGE_STREAM_H_
+#define IMAGE_STREAM_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+
+#include "image-display.h"
+#include "terminal-canvas.h"
+#include "timg-time.h"
+
+namespace timg {
+class EventLoop;
+
+// Splits a byte stream of concatenated JPEG and PNG images, as emitted by
+// many tools on stdout (e.g. MJPEG), at image boundaries. Data can be fed
+// in arbitrary pieces; it is only scanned once.
+// JPEG is followed from marker to marker, so that embedded thumbnails
+// don't confuse it; PNG from chunk to chunk. Anything between images that
+// is neither is skipped.
+class ImageStreamSplitter {
+public:
+    void Append(const char *data, size_t len);
+
+    // If there is a complete image, move the oldest one to "image" and
+    // return true.
+    bool Next(std::string *image);
+
+private:
+    enum class State { kSearchStart, kJPEGMarker, kJPEGScan, kPNGChunk };
+
+    // Advance parsing as far as the data allows. Returns true if an image
+    // is complete, ending at pos_.
+    bool Scan();
+
+    std::string buffer_;
+    size_t pos_ = 0;    // Where parsing continues.
+    State state_ = State::kSearchStart;
+};
+
+// Show images from a stream of concatenated images, each decoded as soon
+// as it is complete and shown in place of the previous one. If images
+// arrive faster than they can be decoded, the stale ones are dropped.
+class ImageStreamLoader {
+public:
+    ImageStreamLoader();
+    ~ImageStreamLoader();
+
+    // Open "filename" ("-" for stdin). Returns false if it can't be opened.
+    bool LoadAndScale(const char *filename,
+                      int display_width, int display_height,
+                      const DisplayOptions &options);
+
+    // Show images until end of stream, "duration" passed, "max_frames"
+    // have been shown (if non-negative) or interrupted.
+    void Play(Duration duration, int max_frames,
+              EventLoop *event_loop, TerminalCanvas *canvas);
+
+private:
+    // Read and feed to the splitter; if "drain", keep reading as long as
+    // more is available right away. Returns false at end of stream.
+    bool ReadAvailable(bool drain);
+
+    // Decode "image" and show it in place of the previous one.
+    bool DecodeAndShow(const std::string &image, TerminalCanvas *canvas);
+
+    int fd_ = -1;
+    int display_width_ = 0;
+    int display_height_ = 0;
+    DisplayOptions options_;
+    ImageStreamSplitter splitter_;
+    int last_height_ = 0;   // Height of frame shown last; 0 if none.
+    std::unique_ptr<char[]> read_buffer_;  // Used by ReadAvailable().
+};
+}  // namespace timg
+
+#endif  // IMAGE_STREAM_H_
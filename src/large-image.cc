@@ -0,0 +1,193 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "large-image.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <Magick++.h>
+
+#include "file-content.h"
+#include "image-display.h"
+
+namespace timg {
+// Images with more pixels are streamed.
+static constexpr int64_t kLargeImagePixels = 32 << 20;
+
+namespace {
+// Box filter receiving the rows of the source image one by one. Each
+// output pixel is the average of the source pixels that map to it.
+class StreamingDownscaler {
+public:
+    StreamingDownscaler(int src_width, int src_height,
+                        int dst_width, int dst_height)
+        : src_width_(src_width), src_height_(src_height),
+          dst_width_(dst_width), dst_height_(dst_height),
+          column_target_(src_width), sums_(4 * dst_width),
+          pixels_(4 * dst_width * dst_height) {
+        for (int x = 0; x < src_width; ++x) {
+            column_target_[x] = (int64_t)x * dst_width / src_width;
+        }
+    }
+
+    // Called for every row coming from the decoder, top to bottom. Returns
+    // false if the rows don't look like what we expect.
+    bool AddRow(const MagickLib::Image *image,
+                const MagickLib::PixelPacket *row, size_t columns) {
+        if ((int)columns != src_width_ || src_y_ >= src_height_)
+            return false;
+        const bool has_alpha = image->matte;
+        for (int x = 0; x < src_width_; ++x) {
+            uint32_t *sum = &sums_[4 * column_target_[x]];
+            sum[0] += ScaleQuantumToChar(row[x].red);
+            sum[1] += ScaleQuantumToChar(row[x].green);
+            sum[2] += ScaleQuantumToChar(row[x].blue);
+            sum[3] += has_alpha
+                ? 255 - ScaleQuantumToChar(row[x].opacity)
+                : 255;
+        }
+        ++rows_summed_;
+        const int dst_y = (int64_t)src_y_ * dst_height_ / src_height_;
+        ++src_y_;
+        const int next_dst_y = (int64_t)src_y_ * dst_height_ / src_height_;
+        if (next_dst_y != dst_y || src_y_ == src_height_) {
+            EmitRow(dst_y);
+        }
+        return true;
+    }
+
+    bool complete() const { return src_y_ == src_height_; }
+
+    // Result in RGBA bytes.
+    const uint8_t *pixels() const { return pixels_.data(); }
+
+private:
+    void EmitRow(int dst_y) {
+        uint8_t *out = &pixels_[4 * dst_width_ * dst_y];
+        int src_x = 0;
+        for (int x = 0; x < dst_width_; ++x) {
+            int count = 0;
+            while (src_x < src_width_ && column_target_[src_x] == x) {
+                ++count;
+                ++src_x;
+            }
+            count *= rows_summed_;
+            uint32_t *sum = &sums_[4 * x];
+            for (int c = 0; c < 4; ++c) {
+                out[4 * x + c] = count ? sum[c] / count : 0;
+                sum[c] = 0;
+            }
+        }
+        rows_summed_ = 0;
+    }
+
+    const int src_width_;
+    const int src_height_;
+    const int dst_width_;
+    const int dst_height_;
+    std::vector<int> column_target_;  // Destination column per source one.
+    std::vector<uint32_t> sums_;      // RGBA sums of the current output row.
+    std::vector<uint8_t> pixels_;
+    int src_y_ = 0;
+    int rows_summed_ = 0;
+};
+}  // namespace
+
+// Callback from Magick's pixel stream: one row of pixels.
+static unsigned int ReceiveRow(const MagickLib::Image *image,
+                               const void *pixels, const size_t columns) {
+    StreamingDownscaler *scaler = (StreamingDownscaler*)image->client_data;
+    // Returning false stops decoding; we also stop after the first image.
+    return scaler->AddRow(image, (const MagickLib::PixelPacket*)pixels,
+                          columns);
+}
+
+void LimitMagickMemory(size_t bytes) {
+    MagickLib::SetMagickResourceLimit(MagickLib::MemoryResource, bytes);
+    MagickLib::SetMagickResourceLimit(MagickLib::MapResource, bytes);
+}
+
+// Image info to read "content" with; "filename" is a hint for the format.
+static MagickLib::ImageInfo *MemoryImageInfo(const FileContent &content,
+                                             const char *filename) {
+    MagickLib::ImageInfo *info = MagickLib::CloneImageInfo(nullptr);
+    if (!FileContent::IsStdin(filename)) {
+        strncpy(info->filename, filename, sizeof(info->filename) - 1);
+    }
+    info->blob = (void*) content.data();
+    info->length = content.size();
+    return info;
+}
+
+bool PingFromMemory(const FileContent &content, const char *filename,
+                    int index, int *width, int *height) {
+    MagickLib::ImageInfo *info = MemoryImageInfo(content, filename);
+    if (index >= 0) {
+        info->subimage = index;
+        info->subrange = 1;
+    }
+    MagickLib::ExceptionInfo exception;
+    MagickLib::GetExceptionInfo(&exception);
+    MagickLib::Image *image = MagickLib::PingBlob(info, content.data(),
+                                                  content.size(),
+                                                  &exception);
+    MagickLib::DestroyExceptionInfo(&exception);
+    MagickLib::DestroyImageInfo(info);
+    if (!image) return false;
+    *width = image->columns;
+    *height = image->rows;
+    MagickLib::DestroyImageList(image);
+    return *width > 0 && *height > 0;
+}
+
+bool ReadLargeImage(const FileContent &content, const char *filename,
+                    int max_width, int max_height, Magick::Image *result) {
+    int src_width, src_height;
+    if (!PingFromMemory(content, filename, -1, &src_width, &src_height)
+        || (int64_t)src_width * src_height <= kLargeImagePixels) {
+        return false;
+    }
+
+    DisplayOptions fit_in_box;
+    int width, height;
+    ScaleToFit(src_width, src_height, max_width, max_height, fit_in_box,
+               &width, &height);
+    // Extreme aspect ratios can round down to nothing.
+    width = std::max(width, 1);
+    height = std::max(height, 1);
+    StreamingDownscaler scaler(src_width, src_height, width, height);
+
+    // Rows are streamed out of the decoder reading from memory.
+    MagickLib::ImageInfo *info = MemoryImageInfo(content, filename);
+    info->client_data = &scaler;
+    MagickLib::ExceptionInfo exception;
+    MagickLib::GetExceptionInfo(&exception);
+    MagickLib::Image *streamed = MagickLib::ReadStream(info, ReceiveRow,
+                                                       &exception);
+    if (streamed) MagickLib::DestroyImageList(streamed);
+    MagickLib::DestroyExceptionInfo(&exception);
+    MagickLib::DestroyImageInfo(info);
+
+    // Decoders reporting a different layout, e.g. tiles, abort early.
+    if (!scaler.complete()) return false;
+    *result = Magick::Image(width, height, "RGBA", Magick::CharPixel,
+                            scaler.pixels());
+    return true;
+}
+}  // namespace timg
@@ -0,0 +1,51 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef LARGE_IMAGE_H_
+#define LARGE_IMAGE_H_
+
+#include <stddef.h>
+
+namespace Magick {
+class Image;
+}
+
+namespace timg {
+class FileContent;
+
+// Limit the memory Magick uses for pixels; beyond that, it uses disk
+// backed pixel caches instead of failing the allocation (or having us
+// killed for running out of memory).
+void LimitMagickMemory(size_t bytes);
+
+// Size of the image in "content" without decoding its pixels; of subimage
+// "index" if that is not negative. The "filename" only serves as a hint
+// for the format. Returns false if there is no such image.
+bool PingFromMemory(const FileContent &content, const char *filename,
+                    int index, int *width, int *height);
+
+// Huge images, such as scanned maps or panoramas, are not decoded as a
+// whole: if "content" has more than a few ten megapixels, its rows are
+// scaled down while they come out of the decoder to fit into "max_width"
+// x "max_height". Memory needed is that of the result plus one row of
+// sums, independent of the size of the input. The "filename" only serves
+// as a hint for the format.
+// Returns false if this is not a huge image or it can't be read this way;
+// then it should be read the regular way.
+bool ReadLargeImage(const FileContent &content, const char *filename,
+                    int max_width, int max_height, Magick::Image *result);
+}  // namespace timg
+
+#endif  // LARGE_IMAGE_H_
@@ -0,0 +1,275 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "mosaic.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "event-loop.h"
+#include "image-display.h"
+#include "terminal-canvas.h"
+
+#ifdef WITH_TIMG_VIDEO
+#  include "video-display.h"
+#endif
+
+namespace timg {
+// No need to update the terminal more often than it can show.
+static constexpr Duration kMinRefreshInterval = Duration::Millis(1000 / 60);
+
+namespace {
+// The picture all streams draw their frames into, and the coordination
+// between the stream threads and the one thread writing to the terminal.
+class Composition {
+public:
+    Composition(int width, int height, int streams, EventLoop *event_loop)
+        : composed_(width, height), running_(streams),
+          event_loop_(event_loop) {}
+
+    // Copy "frame" centered into the tile at "x","y" of given size.
+    void Update(const Framebuffer &frame, int x, int y,
+                int tile_width, int tile_height) {
+        const int width = std::min(frame.width(), tile_width);
+        const int height = std::min(frame.height(), tile_height);
+        x += (tile_width - width) / 2;
+        y += ((tile_height - height) / 2) & ~1;  // Keep cells aligned.
+        {
+            std::lock_guard<std::mutex> l(mutex_);
+            for (int row = 0; row < height; ++row) {
+                std::copy(frame.row(row), frame.row(row) + width,
+                          composed_.row(y + row) + x);
+            }
+            changed_ = true;
+        }
+        event_loop_->Wakeup();
+    }
+
+    // A stream has shown everything it had.
+    void StreamDone() {
+        --running_;
+        event_loop_->Wakeup();
+    }
+
+    // If anything changed since the last call, copy the composed picture
+    // to "out" and return true.
+    bool TakeSnapshot(Framebuffer *out) {
+        std::lock_guard<std::mutex> l(mutex_);
+        if (!changed_) return false;
+        out->CopyFrom(composed_);
+        changed_ = false;
+        return true;
+    }
+
+    bool all_done() const { return running_ == 0; }
+
+    // Wait until "deadline". Returns false if we're asked to stop.
+    bool WaitUntil(const Time &deadline) {
+        std::unique_lock<std::mutex> l(mutex_);
+        const int64_t wait_ns = deadline.nanoseconds()
+            - Time::Now().nanoseconds();
+        return !stop_cond_.wait_for(l, std::chrono::nanoseconds(wait_ns),
+                                    [this]() { return stopping_; });
+    }
+
+    void Stop() {
+        std::lock_guard<std::mutex> l(mutex_);
+        stopping_ = true;
+        stop_cond_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable stop_cond_;
+    Framebuffer composed_;
+    bool changed_ = false;
+    bool stopping_ = false;
+    std::atomic<int> running_;
+    EventLoop *const event_loop_;
+};
+
+// Everything a stream thread needs to know.
+struct Tile {
+    const char *filename;
+    int x, y, width, height;
+};
+}  // namespace
+
+static void PlayImage(ImageLoader *loader, const Tile &tile,
+                      int loops, const Time &end_time,
+                      Composition *composition) {
+    if (!loader->is_animation()) {
+        composition->Update(loader->framebuffer(0),
+                            tile.x, tile.y, tile.width, tile.height);
+        return;
+    }
+    Time next_frame;
+    for (int loop = 0; loops < 0 || loop < loops; ++loop) {
+        for (int n = 0; n < loader->frame_count(); ++n) {
+            composition->Update(loader->framebuffer(n),
+                                tile.x, tile.y, tile.width, tile.height);
+            next_frame.Add(loader->frame_delay(n));
+            if (next_frame >= end_time || !composition->WaitUntil(next_frame))
+                return;
+        }
+    }
+}
+
+#ifdef WITH_TIMG_VIDEO
+static void PlayVideo(VideoLoader *loader, const Tile &tile,
+                      const Time &end_time, Composition *composition) {
+    Time next_frame;
+    const Framebuffer *frame;
+    while ((frame = loader->DecodeScaledFrame()) != nullptr) {
+        composition->Update(*frame, tile.x, tile.y, tile.width, tile.height);
+        next_frame.Add(loader->frame_duration());
+        if (next_frame >= end_time || !composition->WaitUntil(next_frame))
+            return;
+    }
+}
+#endif
+
+// Thread function for one stream: load the file and show its frames in
+// its own pace.
+static void PlayStream(const Tile &tile, const DisplayOptions &options,
+                       const char *bg_color, const char *pattern_color,
+                       int loops, const Time &end_time,
+                       Composition *composition, std::atomic<int> *loaded) {
+    ImageLoader image_loader;
+    if (image_loader.LoadAndScale(tile.filename, tile.width, tile.height,
+                                  options, bg_color, pattern_color)) {
+        ++*loaded;
+        PlayImage(&image_loader, tile, loops, end_time, composition);
+        composition->StreamDone();
+        return;
+    }
+#ifdef WITH_TIMG_VIDEO
+    VideoLoader video_loader;
+    if (video_loader.LoadAndScale(tile.filename, tile.width, tile.height,
+                                  options)) {
+        ++*loaded;
+        PlayVideo(&video_loader, tile, end_time, composition);
+    }
+#endif
+    composition->StreamDone();
+}
+
+bool PlayMosaic(const std::vector<const char *> &files,
+                int display_width, int display_height,
+                const DisplayOptions &display_options,
+                const char *bg_color, const char *pattern_color,
+                Duration duration, int loops,
+                EventLoop *event_loop, TerminalCanvas *canvas) {
+    if (files.empty()) return false;
+    const int count = files.size();
+    const int columns = (int)ceil(sqrt(count));
+    const int rows = (count + columns - 1) / columns;
+    const int tile_width = std::max(1, display_width / columns);
+    const int tile_height = std::max(2, (display_height / rows) & ~1);
+
+    DisplayOptions options = display_options;
+    options.fill_width = options.fill_height = false;
+    options.center_horizontally = false;
+
+    const Time end_time = Time::Now() + duration;
+    Composition composition(tile_width * columns, tile_height * rows,
+                            count, event_loop);
+    std::atomic<int> loaded(0);
+    std::vector<Tile> tiles;
+    for (int i = 0; i < count; ++i) {
+        tiles.push_back({ files[i], (i % columns) * tile_width,
+                          (i / columns) * tile_height,
+                          tile_width, tile_height });
+    }
+    std::vector<std::thread> streams;
+    for (const Tile &tile : tiles) {
+        streams.emplace_back(PlayStream, std::cref(tile), std::cref(options),
+                             bg_color, pattern_color, loops,
+                             std::cref(end_time), &composition, &loaded);
+    }
+
+    // The writer: whenever streams announce new content, send what changed
+    // compared to what is on screen. Streams updating in quick succession
+    // are coalesced into one update.
+    std::unique_ptr<Framebuffer> shown(
+        new Framebuffer(tile_width * columns, tile_height * rows));
+    std::unique_ptr<Framebuffer> next(
+        new Framebuffer(tile_width * columns, tile_height * rows));
+    bool on_screen = false;
+    Time next_refresh;
+    auto show_update = [&]() {
+        if (!composition.TakeSnapshot(next.get())) return;
+        if (on_screen) {
+            canvas->JumpUpPixels(next->height());
+            canvas->SendDifference(*next, *shown, 0);
+        } else {
+            canvas->Send(*next, 0);
+            on_screen = true;
+        }
+        std::swap(shown, next);
+        next_refresh = Time::Now() + kMinRefreshInterval;
+    };
+
+    bool pending = false;  // New content announced, but not shown yet.
+    bool quit = false;
+    while (!quit) {
+        // Check before taking the snapshot, so that we don't miss the
+        // last frames of streams finishing in between.
+        const bool all_done = composition.all_done();
+        if (pending && !(Time::Now() < next_refresh)) {
+            pending = false;
+            show_update();
+        }
+        if (all_done && !pending) {
+            show_update();
+            break;
+        }
+        if (!(Time::Now() < end_time)) break;
+        const Time deadline = (pending && next_refresh < end_time)
+            ? next_refresh : end_time;
+        switch (event_loop->WaitUntil(deadline)) {
+        case EventLoop::Event::kInterrupt:
+            quit = true;
+            break;
+        case EventLoop::Event::kKey:
+            quit = (event_loop->key() == 'q');
+            break;
+        case EventLoop::Event::kResize:
+            // We keep our layout, but the screen needs to be redrawn.
+            canvas->ClearScreen();
+            if (on_screen) canvas->Send(*shown, 0);
+            break;
+        case EventLoop::Event::kWakeup:
+            pending = true;
+            break;
+        case EventLoop::Event::kInput:
+        case EventLoop::Event::kDeadline:
+            break;
+        }
+    }
+
+    composition.Stop();
+    for (std::thread &t : streams) t.join();
+    return loaded > 0;
+}
+}  // namespace timg
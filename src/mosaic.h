@@ -0,0 +1,47 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef MOSAIC_H_
+#define MOSAIC_H_
+
+#include <vector>
+
+#include "timg-time.h"
+
+namespace timg {
+struct DisplayOptions;
+class EventLoop;
+class TerminalCanvas;
+
+// Play "files" -- videos, animations or still images -- all at the same
+// time, each in its own tile of a grid filling "display_width" x
+// "display_height".
+// Every file is decoded on its own thread at its own frame rate and
+// composed into one shared framebuffer. Only one writer talks to the
+// terminal: it sends the character cells that changed since the last
+// update, at most at the terminal refresh rate.
+// Stops after "duration", when interrupted or once all files are done;
+// animations are repeated "loops" times (forever if negative).
+// "bg_color" and "pattern_color" as in ImageLoader::LoadAndScale().
+// Returns false if none of the files could be loaded.
+bool PlayMosaic(const std::vector<const char *> &files,
+                int display_width, int display_height,
+                const DisplayOptions &options,
+                const char *bg_color, const char *pattern_color,
+                Duration duration, int loops,
+                EventLoop *event_loop, TerminalCanvas *canvas);
+}  // namespace timg
+
+#endif  // MOSAIC_H_
@@ -0,0 +1,105 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "pipe-buffer.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace timg {
+PipeBuffer::PipeBuffer(int fd, size_t size)
+    : fd_(fd), buffer_(size), keep_behind_(size / 4),
+      reader_(&PipeBuffer::ReadLoop, this) {
+}
+
+PipeBuffer::~PipeBuffer() {
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+    reader_.join();
+}
+
+void PipeBuffer::ReadLoop() {
+    const int64_t capacity = buffer_.size();
+    for (;;) {
+        int64_t write_pos;
+        size_t space;
+        {
+            std::unique_lock<std::mutex> l(mutex_);
+            cond_.wait(l, [&]() {
+                    return stopping_ || head_ - tail_ < capacity;
+                });
+            if (stopping_) return;
+            write_pos = head_;
+            // Contiguous free space; the reader only looks at [tail, head).
+            space = std::min(capacity - (head_ - tail_),
+                             capacity - head_ % capacity);
+        }
+        // Don't block in read() forever, so that we can stop.
+        struct pollfd p = { fd_, POLLIN, 0 };
+        const int ready = poll(&p, 1, 100);
+        if (ready == 0 || (ready < 0 && errno == EINTR)) continue;
+        const ssize_t r = (ready < 0)
+            ? -1
+            : read(fd_, &buffer_[write_pos % capacity], space);
+        if (r < 0 && errno == EINTR) continue;
+        std::lock_guard<std::mutex> l(mutex_);
+        if (r <= 0) {
+            eof_ = true;
+            error_ = (r < 0);
+            cond_.notify_all();
+            return;
+        }
+        head_ += r;
+        cond_.notify_all();
+    }
+}
+
+int PipeBuffer::Read(uint8_t *out, int size) {
+    const int64_t capacity = buffer_.size();
+    std::unique_lock<std::mutex> l(mutex_);
+    cond_.wait(l, [this]() { return pos_ < head_ || eof_; });
+    if (pos_ >= head_) return error_ ? -1 : 0;
+    const int64_t start = pos_ % capacity;
+    const int n = std::min((int64_t)size,
+                           std::min(head_ - pos_, capacity - start));
+    memcpy(out, &buffer_[start], n);
+    pos_ += n;
+    // Make room for the writer, but keep a bit behind us.
+    if (pos_ - tail_ > keep_behind_) {
+        tail_ = pos_ - keep_behind_;
+        cond_.notify_all();
+    }
+    return n;
+}
+
+int64_t PipeBuffer::Seek(int64_t pos) {
+    std::lock_guard<std::mutex> l(mutex_);
+    if (pos < tail_ || pos > head_) return -1;
+    pos_ = pos;
+    return pos_;
+}
+
+int64_t PipeBuffer::position() const {
+    std::lock_guard<std::mutex> l(mutex_);
+    return pos_;
+}
+}  // namespace timg
@@ -0,0 +1,69 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef PIPE_BUFFER_H_
+#define PIPE_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace timg {
+// Reads a pipe, such as stdin, on its own thread into a large ring buffer,
+// so that the producer on the other end is not held up while we decode,
+// and reads by the consumer are served without system calls most of the
+// time. The most recently consumed part stays around, allowing to seek
+// back a bit, as needed when probing a stream format.
+class PipeBuffer {
+public:
+    // Start reading "fd" into a buffer of "size" bytes.
+    PipeBuffer(int fd, size_t size);
+    ~PipeBuffer();
+
+    // Read up to "size" bytes into "out", waiting until there is data.
+    // Returns number of bytes read, 0 at end of stream, -1 on error.
+    int Read(uint8_t *out, int size);
+
+    // Set read position to the absolute stream offset "pos". Only
+    // possible within what is still in the buffer. Returns the new
+    // position or -1.
+    int64_t Seek(int64_t pos);
+
+    int64_t position() const;
+
+private:
+    void ReadLoop();
+
+    const int fd_;
+    std::vector<uint8_t> buffer_;
+    const int64_t keep_behind_;  // Consumed bytes we keep for seeking back.
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    int64_t tail_ = 0;   // Stream offset of oldest byte in buffer.
+    int64_t pos_ = 0;    // Read position.
+    int64_t head_ = 0;   // Stream offset after the newest byte.
+    bool eof_ = false;
+    bool error_ = false;
+    bool stopping_ = false;
+    std::thread reader_;
+};
+}  // namespace timg
+
+#endif  // PIPE_BUFFER_H_
@@ -0,0 +1,373 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+
+#include "raw-video.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+#include "event-loop.h"
+#include "framebuffer-scaler.h"
+
+namespace timg {
+static constexpr char kY4MMagic[] = "YUV4MPEG2 ";
+static constexpr char kY4MFrameMagic[] = "FRAME";
+
+RawVideoLoader::RawVideoLoader() {}
+
+RawVideoLoader::~RawVideoLoader() {
+    if (fd_ > STDERR_FILENO) close(fd_);
+}
+
+bool RawVideoLoader::ParseFormat(const char *format) {
+    static const struct {
+        const char *name;
+        PixelFormat format;
+    } kFormats[] = {
+        { "rgb24", PixelFormat::kRGB24 },
+        { "bgr24", PixelFormat::kBGR24 },
+        { "rgba",  PixelFormat::kRGBA },
+        { "bgra",  PixelFormat::kBGRA },
+        { "y4m",   PixelFormat::kY4M },
+    };
+    const char *const colon = strchr(format, ':');
+    const char *const at = strchr(format, '@');
+    const size_t name_len = colon ? colon - format
+        : (at ? at - format : strlen(format));
+    bool found = false;
+    for (const auto &f : kFormats) {
+        if (strlen(f.name) == name_len
+            && strncasecmp(format, f.name, name_len) == 0) {
+            format_ = f.format;
+            found = true;
+        }
+    }
+    if (!found) {
+        fprintf(stderr, "%s: unknown raw format. Known are rgb24, bgr24, "
+                "rgba, bgra and y4m\n", format);
+        return false;
+    }
+    if (format_ != PixelFormat::kY4M) {
+        if (!colon || sscanf(colon + 1, "%dx%d", &width_, &height_) != 2
+            || width_ <= 0 || height_ <= 0) {
+            fprintf(stderr, "%s: expected <format>:<width>x<height>[@fps]\n",
+                    format);
+            return false;
+        }
+    }
+    if (at) {
+        const double fps = atof(at + 1);
+        if (fps <= 0) {
+            fprintf(stderr, "%s: invalid frame rate\n", format);
+            return false;
+        }
+        frame_duration_ = Duration::Nanos(1e9 / fps);
+    }
+    return true;
+}
+
+bool RawVideoLoader::ReadY4MHeader() {
+    std::string header;
+    char c;
+    while (ReadFully(&c, 1, nullptr) && c != '\n') {
+        header.push_back(c);
+        if (header.size() > 1024) break;   // Not a reasonable header.
+    }
+    if (header.compare(0, strlen(kY4MMagic), kY4MMagic) != 0) {
+        fprintf(stderr, "Not a YUV4MPEG2 stream\n");
+        return false;
+    }
+    const bool frame_rate_given = (frame_duration_.nanoseconds() > 0);
+    std::string colorspace = "420";
+    size_t pos = strlen(kY4MMagic) - 1;
+    while (pos != std::string::npos && pos + 1 < header.size()) {
+        const size_t end = header.find(' ', pos + 1);
+        const size_t length = (end == std::string::npos)
+            ? std::string::npos
+            : end - pos - 1;
+        const std::string param = header.substr(pos + 1, length);
+        pos = end;
+        if (param.empty()) continue;
+        const char *value = param.c_str() + 1;
+        switch (param[0]) {
+        case 'W': width_ = atoi(value); break;
+        case 'H': height_ = atoi(value); break;
+        case 'C': colorspace = value; break;
+        case 'F': {
+            int num = 0, den = 0;
+            if (!frame_rate_given
+                && sscanf(value, "%d:%d", &num, &den) == 2
+                && num > 0 && den > 0) {
+                frame_duration_ = Duration::Nanos(1e9 * den / num);
+            }
+            break;
+        }
+        }
+    }
+    if (colorspace.compare(0, 3, "420") == 0) {
+        chroma_x_shift_ = chroma_y_shift_ = 1;
+    } else if (colorspace == "422") {
+        chroma_x_shift_ = 1;
+        chroma_y_shift_ = 0;
+    } else if (colorspace == "444") {
+        chroma_x_shift_ = chroma_y_shift_ = 0;
+    } else if (colorspace == "mono") {
+        has_chroma_ = false;
+    } else {
+        fprintf(stderr, "Unsupported Y4M colorspace C%s\n",
+                colorspace.c_str());
+        return false;
+    }
+    if (width_ <= 0 || height_ <= 0) {
+        fprintf(stderr, "Y4M stream without geometry\n");
+        return false;
+    }
+    const size_t luma_size = (size_t)width_ * height_;
+    const size_t chroma_size = !has_chroma_ ? 0
+        : (size_t)((width_ + chroma_x_shift_) >> chroma_x_shift_)
+        * ((height_ + chroma_y_shift_) >> chroma_y_shift_);
+    yuv_.resize(luma_size + 2 * chroma_size);
+    return true;
+}
+
+bool RawVideoLoader::LoadAndScale(const char *filename, const char *format,
+                                  int display_width, int display_height,
+                                  const DisplayOptions &options) {
+    if (!ParseFormat(format))
+        return false;
+    fd_ = (strcmp(filename, "-") == 0) ? STDIN_FILENO
+        : open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        return false;
+    }
+    if (format_ == PixelFormat::kY4M && !ReadY4MHeader())
+        return false;
+
+#ifdef F_SETPIPE_SZ
+    // Have a whole frame fit into the pipe, so that the producer doesn't
+    // have to wait for us to pick up each piece. Only works on pipes and
+    // FIFOs and is limited by the system; best effort.
+    const size_t pipe_size = std::max((size_t)width_ * height_ * 4,
+                                      yuv_.size());
+    fcntl(fd_, F_SETPIPE_SZ, (int)std::min(pipe_size, (size_t)INT_MAX));
+#endif
+
+    frame_.reset(new Framebuffer(width_, height_));
+    options_ = options;
+    return SetupScaling(display_width, display_height);
+}
+
+bool RawVideoLoader::SetupScaling(int display_width, int display_height) {
+    int target_width, target_height;
+    DisplayOptions opts(options_);
+    opts.fill_height = false;  // This only makes sense for horizontal scroll.
+    ScaleToFit(width_, height_, display_width, display_height, opts,
+               &target_width, &target_height);
+    target_width = std::max(target_width, 1);
+    target_height = std::max(target_height, 1);
+    center_indentation_ = opts.center_horizontally
+        ? (display_width - target_width) / 2
+        : 0;
+    if (target_width == width_ && target_height == height_) {
+        scaler_.reset();
+        scaled_.reset();
+    } else {
+        scaler_.reset(new FramebufferScaler(width_, height_,
+                                            target_width, target_height));
+        scaled_.reset(new Framebuffer(target_width, target_height));
+    }
+    return true;
+}
+
+bool RawVideoLoader::ReadFully(void *buffer, size_t len,
+                               EventLoop *event_loop) {
+    char *pos = (char*) buffer;
+    while (len > 0) {
+        // Wait for data while still being responsive to the user.
+        while (event_loop && input_watched_) {
+            const EventLoop::Event event = event_loop->WaitUntil(
+                Time::Now() + Duration::InfiniteFuture());
+            if (event == EventLoop::Event::kInterrupt ||
+                (event == EventLoop::Event::kKey && event_loop->key() == 'q')) {
+                return false;
+            }
+            if (event == EventLoop::Event::kResize) resize_pending_ = true;
+            if (event == EventLoop::Event::kInput &&
+                event_loop->input_fd() == fd_) {
+                break;
+            }
+        }
+        const ssize_t r = read(fd_, pos, len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        pos += r;
+        len -= r;
+    }
+    return true;
+}
+
+// Pixels with three or four bytes each are read into the end of the
+// framebuffer memory, then expanded in place from the front. A pixel is
+// always read before it or any pixel after it is overwritten.
+void RawVideoLoader::ExpandPackedPixels() {
+    int bytes_per_pixel = 4, r_pos = 0, b_pos = 2;
+    switch (format_) {
+    case PixelFormat::kRGB24: bytes_per_pixel = 3; break;
+    case PixelFormat::kBGR24: bytes_per_pixel = 3; r_pos = 2; b_pos = 0; break;
+    case PixelFormat::kRGBA:  break;
+    case PixelFormat::kBGRA:  r_pos = 2; b_pos = 0; break;
+    case PixelFormat::kY4M:   return;
+    }
+    const size_t pixel_count = (size_t)width_ * height_;
+    Framebuffer::rgb_t *out = frame_->row(0);
+    const uint8_t *in = (const uint8_t*) out
+        + (sizeof(Framebuffer::rgb_t) - bytes_per_pixel) * pixel_count;
+    for (size_t i = 0; i < pixel_count; ++i, in += bytes_per_pixel) {
+        const uint8_t r = in[r_pos], g = in[1], b = in[b_pos];
+        out[i] = (r << 16) | (g << 8) | b;
+    }
+}
+
+static inline uint8_t Clamp(int value) {
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+// BT.601 with limited range, which is what Y4M streams typically are.
+void RawVideoLoader::ConvertYUV() {
+    const int chroma_width = (width_ + chroma_x_shift_) >> chroma_x_shift_;
+    const uint8_t *const luma = yuv_.data();
+    const uint8_t *const u_plane = luma + (size_t)width_ * height_;
+    const uint8_t *const v_plane
+        = u_plane + (yuv_.size() - (u_plane - luma)) / 2;
+    for (int y = 0; y < height_; ++y) {
+        const uint8_t *y_row = luma + (size_t)y * width_;
+        const size_t chroma_row = (size_t)(y >> chroma_y_shift_) * chroma_width;
+        Framebuffer::rgb_t *out = frame_->row(y);
+        for (int x = 0; x < width_; ++x) {
+            const int c = 298 * (y_row[x] - 16);
+            int d = 0, e = 0;
+            if (has_chroma_) {
+                const size_t ci = chroma_row + (x >> chroma_x_shift_);
+                d = u_plane[ci] - 128;
+                e = v_plane[ci] - 128;
+            }
+            out[x] = (Clamp((c + 409 * e + 128) >> 8) << 16)
+                | (Clamp((c - 100 * d - 208 * e + 128) >> 8) << 8)
+                | Clamp((c + 516 * d + 128) >> 8);
+        }
+    }
+}
+
+bool RawVideoLoader::ReadFrame(EventLoop *event_loop) {
+    // Pipes and FIFOs can be waited on, regular files are always ready.
+    // Only watched while reading; data waiting for us is no event otherwise.
+    input_watched_ = event_loop->WatchInput(fd_);
+    const bool success = ReadFrameData(event_loop);
+    if (input_watched_) event_loop->UnwatchInput(fd_);
+    input_watched_ = false;
+    return success;
+}
+
+bool RawVideoLoader::ReadFrameData(EventLoop *event_loop) {
+    if (format_ == PixelFormat::kY4M) {
+        // Each frame starts with FRAME and optional parameters up to newline.
+        char magic[sizeof(kY4MFrameMagic) - 1];
+        if (!ReadFully(magic, sizeof(magic), event_loop)
+            || memcmp(magic, kY4MFrameMagic, sizeof(magic)) != 0) {
+            return false;
+        }
+        char c;
+        do {
+            if (!ReadFully(&c, 1, event_loop)) return false;
+        } while (c != '\n');
+        if (!ReadFully(yuv_.data(), yuv_.size(), event_loop))
+            return false;
+        ConvertYUV();
+        return true;
+    }
+    const int bytes_per_pixel =
+        (format_ == PixelFormat::kRGB24 || format_ == PixelFormat::kBGR24)
+        ? 3 : 4;
+    const size_t pixel_count = (size_t)width_ * height_;
+    uint8_t *const destination = (uint8_t*) frame_->row(0)
+        + (sizeof(Framebuffer::rgb_t) - bytes_per_pixel) * pixel_count;
+    if (!ReadFully(destination, bytes_per_pixel * pixel_count, event_loop))
+        return false;
+    ExpandPackedPixels();
+    return true;
+}
+
+void RawVideoLoader::ShowFrame(TerminalCanvas *canvas) {
+    const Framebuffer *to_show = frame_.get();
+    if (scaler_) {
+        scaler_->Scale(*frame_, scaled_.get());
+        to_show = scaled_.get();
+    }
+    if (!is_first_frame_) canvas->JumpUpPixels(to_show->height());
+    canvas->Send(*to_show, center_indentation_);
+    is_first_frame_ = false;
+}
+
+void RawVideoLoader::Play(Duration duration, int max_frames,
+                          EventLoop *event_loop, TerminalCanvas *canvas) {
+    event_loop->StartPlayback();
+    const bool paced = frame_duration_.nanoseconds() > 0;
+    const Time end_time = Time::Now() + duration;
+    Time next_frame;
+    for (int frame = 0; max_frames < 0 || frame < max_frames; ++frame) {
+        if (!(Time::Now() < end_time) || !ReadFrame(event_loop))
+            break;
+        if (resize_pending_) {
+            resize_pending_ = false;
+            SetupScaling(event_loop->terminal_pixel_width(),
+                         event_loop->terminal_pixel_height());
+            canvas->ClearScreen();
+            is_first_frame_ = true;
+        }
+        ShowFrame(canvas);
+        if (!paced) {
+            // As fast as we can read. Still, signals and keys are only
+            // noticed when looking at the event loop.
+            const EventLoop::Event event = event_loop->WaitUntil(Time::Now());
+            if (event == EventLoop::Event::kInterrupt ||
+                (event == EventLoop::Event::kKey && event_loop->key() == 'q')) {
+                break;
+            }
+            if (event == EventLoop::Event::kResize) resize_pending_ = true;
+            continue;
+        }
+
+        next_frame.Add(frame_duration_);
+        const EventLoop::Command command =
+            event_loop->WaitForNextFrame(next_frame);
+        if (command == EventLoop::Command::kQuit ||
+            command == EventLoop::Command::kExitKey) {
+            break;
+        }
+        if (command == EventLoop::Command::kResize) resize_pending_ = true;
+        if (command == EventLoop::Command::kResume) next_frame = Time::Now();
+    }
+}
+}  // namespace timg
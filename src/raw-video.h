@@ -0,0 +1,100 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+
+#ifndef RAW_VIDEO_H_
+#define RAW_VIDEO_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "image-display.h"
+#include "terminal-canvas.h"
+#include "timg-time.h"
+
+namespace timg {
+class EventLoop;
+class FramebufferScaler;
+
+// Video frames read as-is from a pipe, FIFO or file, e.g. produced by some
+// program generating visualizations. There is no probing or decoding
+// through GraphicsMagick or libav: fixed-size frames are read with large
+// reads straight into framebuffer memory, then scaled and sent.
+class RawVideoLoader {
+public:
+    RawVideoLoader();
+    ~RawVideoLoader();
+
+    // Open "filename" ("-" for stdin) with frames in the given "format":
+    // "<pixel-format>:<width>x<height>[@<fps>]" with one of the pixel
+    // formats rgb24, bgr24, rgba or bgra, or "y4m[@<fps>]" for a YUV4MPEG2
+    // stream that brings its own geometry and frame rate.
+    // Without frame rate, frames are shown as soon as they arrive.
+    // Returns false and prints a message if this does not work out.
+    bool LoadAndScale(const char *filename, const char *format,
+                      int display_width, int display_height,
+                      const DisplayOptions &options);
+
+    // Show frames until end of stream, "duration" passed or "max_frames"
+    // have been shown (if non-negative).
+    void Play(Duration duration, int max_frames,
+              EventLoop *event_loop, TerminalCanvas *canvas);
+
+private:
+    enum class PixelFormat { kRGB24, kBGR24, kRGBA, kBGRA, kY4M };
+
+    bool ParseFormat(const char *format);
+    bool ReadY4MHeader();
+    bool SetupScaling(int display_width, int display_height);
+
+    // Read exactly "len" bytes. If the input can be watched by the
+    // "event_loop" (nullptr: can't), keep handling events while waiting.
+    // Returns false at end of stream or if the user wants to quit.
+    bool ReadFully(void *buffer, size_t len, EventLoop *event_loop);
+
+    // Read next frame into frame_.
+    bool ReadFrame(EventLoop *event_loop);
+    bool ReadFrameData(EventLoop *event_loop);
+    void ExpandPackedPixels();
+    void ConvertYUV();
+
+    void ShowFrame(TerminalCanvas *canvas);
+
+    int fd_ = -1;
+    PixelFormat format_ = PixelFormat::kRGB24;
+    int width_ = 0;
+    int height_ = 0;
+    Duration frame_duration_;   // Zero: show as fast as frames arrive.
+    DisplayOptions options_;
+
+    // Y4M chroma subsampling as shift of width/height. No chroma: mono.
+    int chroma_x_shift_ = 1;
+    int chroma_y_shift_ = 1;
+    bool has_chroma_ = true;
+    std::vector<uint8_t> yuv_;   // Y4M planes as read.
+
+    std::unique_ptr<Framebuffer> frame_;     // Frame in input size.
+    std::unique_ptr<FramebufferScaler> scaler_;
+    std::unique_ptr<Framebuffer> scaled_;    // nullptr if no scaling needed.
+    int center_indentation_ = 0;
+    bool is_first_frame_ = true;
+    bool input_watched_ = false;
+    bool resize_pending_ = false;
+};
+}  // namespace timg
+
+#endif  // RAW_VIDEO_H_
@@ -0,0 +1,47 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "rewind-buffer.h"
+
+namespace timg {
+RewindBuffer::RewindBuffer(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+void RewindBuffer::Push(Duration pts, int height,
+                        const char *data, size_t len) {
+    if (len > max_bytes_) return;   // Would never fit.
+
+    // Make room. The string of the last evicted frame is recycled, so that
+    // in steady state we keep re-using the same allocations.
+    std::string recycled;
+    while (!frames_.empty() && bytes_used_ + len > max_bytes_) {
+        bytes_used_ -= frames_.front().data.size();
+        recycled.swap(frames_.front().data);
+        frames_.pop_front();
+    }
+    recycled.assign(data, len);
+
+    frames_.push_back(Frame());
+    Frame &frame = frames_.back();
+    frame.pts = pts;
+    frame.height = height;
+    frame.data.swap(recycled);
+    bytes_used_ += len;
+}
+
+void RewindBuffer::Clear() {
+    frames_.clear();
+    bytes_used_ = 0;
+}
+}  // namespace timg
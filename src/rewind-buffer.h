@@ -0,0 +1,73 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef REWIND_BUFFER_H_
+#define REWIND_BUFFER_H_
+
+#include <stddef.h>
+
+#include <deque>
+#include <string>
+
+#include "timg-time.h"
+
+namespace timg {
+// Bounded ring of the most recently shown frames, kept in their already
+// encoded form as produced by TerminalCanvas::Encode(), together with their
+// presentation timestamp.
+// Stepping backward in a video otherwise requires to seek to an earlier
+// keyframe and decode forward; from this buffer, short rewinds can just
+// re-send the bytes.
+class RewindBuffer {
+public:
+    struct Frame {
+        Duration pts;       // Presentation time within the stream.
+        int height;         // Pixel height, needed to jump up again.
+        std::string data;   // Encoded bytes ready to be sent.
+    };
+
+    // Create buffer that keeps as many frames as fit in "max_bytes" of
+    // encoded data. A budget of zero disables recording.
+    explicit RewindBuffer(size_t max_bytes);
+    RewindBuffer(const RewindBuffer &) = delete;
+
+    bool enabled() const { return max_bytes_ > 0; }
+
+    // Record a new frame at the newest end of the ring. If the budget is
+    // exceeded, the oldest frames are dropped.
+    void Push(Duration pts, int height, const char *data, size_t len);
+
+    // Number of frames currently available.
+    size_t size() const { return frames_.size(); }
+
+    // Get frame "back" steps before the newest one, 0 being the newest.
+    // Requires back < size().
+    const Frame &Get(size_t back) const {
+        return frames_[frames_.size() - 1 - back];
+    }
+
+    // Forget all frames, e.g. after a seek made them discontinuous.
+    void Clear();
+
+    size_t memory_used() const { return bytes_used_; }
+
+private:
+    const size_t max_bytes_;
+    size_t bytes_used_ = 0;
+    std::deque<Frame> frames_;
+};
+}  // namespace timg
+
+#endif  // REWIND_BUFFER_H_
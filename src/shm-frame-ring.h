@@ -0,0 +1,71 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+
+#ifndef SHM_FRAME_RING_H_
+#define SHM_FRAME_RING_H_
+
+// Layout of the POSIX shared memory ring of frames that timg attaches to
+// with "timg --shm <name> [<name>...]", the names given as arguments.
+// Plain C, so that producers can include it as well.
+//
+// The shared memory object starts with a struct timg_shm_header, followed
+// by "slot_count" slots, the first at "data_offset", each "slot_stride"
+// bytes apart. Each slot starts with a struct timg_shm_slot, pixels follow
+// at TIMG_SHM_SLOT_HEADER_SIZE, row after row without gaps, each pixel a
+// uint32_t 0x00RRGGBB in host byte order. That is exactly timg's own
+// framebuffer layout, so frames are shown right from shared memory.
+//
+// Producer, for each new frame:
+//   1. n = newest + 1; use slot n % slot_count.
+//   2. Store 0 to the slot's sequence: being written. Follow it with a
+//      release fence (e.g. atomic_thread_fence(memory_order_release)),
+//      so that no pixel write becomes visible before the 0. Without it,
+//      this only works on strongly ordered CPUs such as x86.
+//   3. Write the pixels.
+//   4. Store n to the slot's sequence, then to header newest (both with
+//      release semantics, so the pixels are visible before).
+//   5. Increment futex and FUTEX_WAKE waiters on it (not FUTEX_PRIVATE).
+// timg only reads. It always shows the newest frame; if the producer is
+// faster than the terminal, frames in between are skipped. A slot that
+// has been overwritten while timg was looking at it is detected by its
+// sequence number, seqlock-style, and the newer frame is taken instead.
+
+#include <stdint.h>
+
+#define TIMG_SHM_MAGIC   0x474d4954   /* "TIMG" in little endian. */
+#define TIMG_SHM_VERSION 1
+#define TIMG_SHM_FORMAT_XRGB32 1      /* uint32_t 0x00RRGGBB per pixel. */
+#define TIMG_SHM_SLOT_HEADER_SIZE 64  /* Pixels start cache line aligned. */
+
+struct timg_shm_header {
+    uint32_t magic;         /* TIMG_SHM_MAGIC */
+    uint32_t version;       /* TIMG_SHM_VERSION */
+    uint32_t width;         /* Frame geometry in pixels. */
+    uint32_t height;
+    uint32_t format;        /* TIMG_SHM_FORMAT_XRGB32 */
+    uint32_t slot_count;
+    uint64_t slot_stride;   /* Bytes from one slot to the next. */
+    uint64_t data_offset;   /* Offset of the first slot. */
+    uint64_t newest;        /* Sequence of newest complete frame; 0: none. */
+    uint32_t futex;         /* Changes with every new frame. */
+    uint32_t reserved;
+};
+
+struct timg_shm_slot {
+    uint64_t sequence;      /* Frame in this slot; 0 while being written. */
+};
+
+#endif  /* SHM_FRAME_RING_H_ */
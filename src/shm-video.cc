@@ -0,0 +1,246 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+
+#include "shm-video.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "event-loop.h"
+#include "framebuffer-scaler.h"
+#include "shm-frame-ring.h"
+
+namespace timg {
+// No need to update the terminal more often than it can show.
+static constexpr Duration kMinRefreshInterval = Duration::Millis(1000 / 60);
+
+// How often the producer watching thread checks if it should stop.
+static constexpr Duration kFutexTimeout = Duration::Millis(100);
+
+ShmVideoLoader::ShmVideoLoader() : stop_watching_(false) {}
+
+ShmVideoLoader::~ShmVideoLoader() {
+    slots_.clear();
+    if (header_) munmap(const_cast<timg_shm_header*>(header_), mapped_size_);
+}
+
+bool ShmVideoLoader::LoadAndScale(const char *name,
+                                  int display_width, int display_height,
+                                  const DisplayOptions &options) {
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(timg_shm_header)) {
+        fprintf(stderr, "%s: not a timg frame ring\n", name);
+        close(fd);
+        return false;
+    }
+    void *const mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED,
+                              fd, 0);
+    close(fd);   // Mapping stays valid.
+    if (mapped == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        return false;
+    }
+    header_ = (const timg_shm_header*) mapped;
+    mapped_size_ = st.st_size;
+
+    // The layout is only read once, from this copy; what we checked is what
+    // we use, whatever the producer writes to the header later.
+    const timg_shm_header header = *header_;
+
+    // Sizes are compared to what is mapped by dividing, so that nonsense
+    // values can't overflow into something that looks fine.
+    const uint64_t max_pixels = mapped_size_ / sizeof(Framebuffer::rgb_t);
+    const bool sizes_fit = header.width != 0 && header.height != 0
+        && header.slot_count != 0
+        && header.height <= max_pixels / header.width
+        && header.data_offset <= mapped_size_
+        && header.slot_stride
+           <= (mapped_size_ - header.data_offset) / header.slot_count;
+    const uint64_t frame_bytes = sizes_fit
+        ? (uint64_t)header.width * header.height * sizeof(Framebuffer::rgb_t)
+        : 0;
+    if (header.magic != TIMG_SHM_MAGIC
+        || header.version != TIMG_SHM_VERSION
+        || header.format != TIMG_SHM_FORMAT_XRGB32
+        || !sizes_fit
+        || header.slot_stride < TIMG_SHM_SLOT_HEADER_SIZE + frame_bytes
+        || header.data_offset < sizeof(timg_shm_header)
+        || header.data_offset % alignof(uint64_t) != 0
+        || header.slot_stride % alignof(uint64_t) != 0) {
+        fprintf(stderr, "%s: not a compatible timg frame ring\n", name);
+        return false;
+    }
+    width_ = header.width;
+    height_ = header.height;
+    const char *const data = (const char*) mapped + header.data_offset;
+    for (uint32_t i = 0; i < header.slot_count; ++i) {
+        const char *const slot = data + (uint64_t)i * header.slot_stride;
+        slot_sequences_.push_back(&((const timg_shm_slot*) slot)->sequence);
+        slots_.emplace_back(new Framebuffer(
+                                width_, height_,
+                                (const Framebuffer::rgb_t*)
+                                (slot + TIMG_SHM_SLOT_HEADER_SIZE)));
+    }
+    options_ = options;
+    return SetupScaling(display_width, display_height);
+}
+
+bool ShmVideoLoader::SetupScaling(int display_width, int display_height) {
+    int target_width, target_height;
+    DisplayOptions opts(options_);
+    opts.fill_height = false;  // This only makes sense for horizontal scroll.
+    ScaleToFit(width_, height_, display_width, display_height, opts,
+               &target_width, &target_height);
+    target_width = std::max(target_width, 1);
+    target_height = std::max(target_height, 1);
+    center_indentation_ = opts.center_horizontally
+        ? (display_width - target_width) / 2
+        : 0;
+    if (target_width == width_ && target_height == height_) {
+        scaler_.reset();
+        scaled_.reset();
+    } else {
+        scaler_.reset(new FramebufferScaler(width_, height_,
+                                            target_width, target_height));
+        scaled_.reset(new Framebuffer(target_width, target_height));
+    }
+    return true;
+}
+
+uint64_t ShmVideoLoader::newest_sequence() const {
+    return __atomic_load_n(&header_->newest, __ATOMIC_ACQUIRE);
+}
+
+const uint64_t *ShmVideoLoader::slot_sequence(uint64_t sequence) const {
+    return slot_sequences_[sequence % slot_sequences_.size()];
+}
+
+bool ShmVideoLoader::StillValid(uint64_t sequence) const {
+    // Pixel reads before must not be moved after reading the sequence.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(slot_sequence(sequence), __ATOMIC_RELAXED)
+        == sequence;
+}
+
+bool ShmVideoLoader::ShowNewest(TerminalCanvas *canvas) {
+    // If the producer laps us while we look at a frame, just try again
+    // with what is newest then. Don't starve if it does so all the time.
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        const uint64_t sequence = newest_sequence();
+        if (sequence == 0 || sequence == shown_sequence_)
+            return false;
+        if (__atomic_load_n(slot_sequence(sequence), __ATOMIC_ACQUIRE)
+            != sequence) {
+            continue;
+        }
+        const Framebuffer &frame = *slots_[sequence % slots_.size()];
+        const Framebuffer *to_show = &frame;
+        if (scaler_) {
+            scaler_->Scale(frame, scaled_.get());
+            to_show = scaled_.get();
+        }
+        size_t len;
+        const char *data = canvas->Encode(*to_show, center_indentation_,
+                                          &len);
+        if (!StillValid(sequence))
+            continue;
+        if (!is_first_frame_) canvas->JumpUpPixels(to_show->height());
+        canvas->SendEncoded(data, len);
+        is_first_frame_ = false;
+        shown_sequence_ = sequence;
+        return true;
+    }
+    return false;
+}
+
+void ShmVideoLoader::WatchProducer(EventLoop *event_loop) {
+    const uint32_t *const futex_word = &header_->futex;
+    uint32_t seen = __atomic_load_n(futex_word, __ATOMIC_ACQUIRE);
+    const struct timespec timeout = kFutexTimeout.duration();
+    while (!stop_watching_) {
+        // Shared between processes, so no FUTEX_PRIVATE_FLAG.
+        syscall(SYS_futex, futex_word, FUTEX_WAIT, seen, &timeout,
+                nullptr, 0);
+        const uint32_t now = __atomic_load_n(futex_word, __ATOMIC_ACQUIRE);
+        if (now != seen) {
+            seen = now;
+            event_loop->Wakeup();
+        }
+    }
+}
+
+void ShmVideoLoader::Play(Duration duration, int max_frames,
+                          EventLoop *event_loop, TerminalCanvas *canvas) {
+    stop_watching_ = false;
+    std::thread watcher(&ShmVideoLoader::WatchProducer, this, event_loop);
+
+    const Time end_time = Time::Now() + duration;
+    int frames_shown = ShowNewest(canvas) ? 1 : 0;
+    Time next_refresh = Time::Now() + kMinRefreshInterval;
+    bool pending = false;   // Producer announced a frame not shown yet.
+    bool done = false;
+    while (!done && (max_frames < 0 || frames_shown < max_frames)) {
+        const Time &deadline = (pending && next_refresh < end_time)
+            ? next_refresh : end_time;
+        switch (event_loop->WaitUntil(deadline)) {
+        case EventLoop::Event::kInterrupt:
+            done = true;
+            break;
+        case EventLoop::Event::kKey:
+            done = (event_loop->key() == 'q');
+            break;
+        case EventLoop::Event::kResize:
+            SetupScaling(event_loop->terminal_pixel_width(),
+                         event_loop->terminal_pixel_height());
+            canvas->ClearScreen();
+            is_first_frame_ = true;
+            shown_sequence_ = 0;   // Show again in new size.
+            pending = true;
+            break;
+        case EventLoop::Event::kWakeup:
+            pending = true;
+            break;
+        case EventLoop::Event::kDeadline:
+            done = !(Time::Now() < end_time);
+            break;
+        case EventLoop::Event::kInput:
+            break;
+        }
+        if (!done && pending && !(Time::Now() < next_refresh)) {
+            pending = false;
+            if (ShowNewest(canvas)) ++frames_shown;
+            next_refresh = Time::Now() + kMinRefreshInterval;
+        }
+    }
+    stop_watching_ = true;
+    watcher.join();
+}
+}  // namespace timg
@@ -0,0 +1,95 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+
+#ifndef SHM_VIDEO_H_
+#define SHM_VIDEO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "image-display.h"
+#include "terminal-canvas.h"
+#include "timg-time.h"
+
+struct timg_shm_header;
+
+namespace timg {
+class EventLoop;
+class FramebufferScaler;
+
+// Video from a producer in another process writing frames into a POSIX
+// shared memory ring as described in shm-frame-ring.h. Frames are read in
+// place: if no scaling is needed, they are encoded right from shared
+// memory.
+class ShmVideoLoader {
+public:
+    ShmVideoLoader();
+    ~ShmVideoLoader();
+
+    // Attach to shared memory object "name" (as in shm_open()) and set up
+    // scaling. Returns false and prints a message if that does not work out.
+    bool LoadAndScale(const char *name,
+                      int display_width, int display_height,
+                      const DisplayOptions &options);
+
+    // Show the newest frame whenever the producer announces one, until
+    // "duration" passed, "max_frames" have been shown (if non-negative) or
+    // interrupted.
+    void Play(Duration duration, int max_frames,
+              EventLoop *event_loop, TerminalCanvas *canvas);
+
+private:
+    bool SetupScaling(int display_width, int display_height);
+
+    uint64_t newest_sequence() const;
+    const uint64_t *slot_sequence(uint64_t sequence) const;
+
+    // Returns true if the slot still contains frame "sequence", i.e. the
+    // producer did not start to overwrite it. Use after reading pixels.
+    bool StillValid(uint64_t sequence) const;
+
+    // Show newest frame unless that is what is shown already. Returns
+    // true if a frame was shown.
+    bool ShowNewest(TerminalCanvas *canvas);
+
+    // Thread: wait on the futex and tell the event loop about new frames.
+    void WatchProducer(EventLoop *event_loop);
+
+    const timg_shm_header *header_ = nullptr;
+    size_t mapped_size_ = 0;
+    int width_ = 0;
+    int height_ = 0;
+    DisplayOptions options_;
+
+    // Framebuffers looking at the pixels of each slot and the sequence
+    // word of each slot. Set up once from the checked header; the producer
+    // could change the header in the mapping afterwards.
+    std::vector<std::unique_ptr<Framebuffer>> slots_;
+    std::vector<const uint64_t *> slot_sequences_;
+    std::unique_ptr<FramebufferScaler> scaler_;
+    std::unique_ptr<Framebuffer> scaled_;   // nullptr if no scaling needed.
+    int center_indentation_ = 0;
+    uint64_t shown_sequence_ = 0;
+    bool is_first_frame_ = true;
+    std::atomic<bool> stop_watching_;
+};
+}  // namespace timg
+
+#endif  // SHM_VIDEO_H_
@@ -0,0 +1,75 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "temporal-filter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace timg {
+static int ColorDistance(Framebuffer::rgb_t a, Framebuffer::rgb_t b) {
+    const int dr = abs((int)((a >> 16) & 0xff) - (int)((b >> 16) & 0xff));
+    const int dg = abs((int)((a >> 8) & 0xff) - (int)((b >> 8) & 0xff));
+    const int db = abs((int)(a & 0xff) - (int)(b & 0xff));
+    return std::max(dr, std::max(dg, db));
+}
+
+TemporalFilter::TemporalFilter(int threshold, int refresh_frames)
+    : threshold_(threshold),
+      refresh_frames_(std::max(1, std::min(refresh_frames, 255))) {
+}
+
+void TemporalFilter::Reset() {
+    shown_.reset();
+}
+
+const Framebuffer &TemporalFilter::Apply(const Framebuffer &frame,
+                                         const Framebuffer **previous) {
+    const int width = frame.width();
+    const int height = frame.height();
+    if (!shown_ || shown_->width() != width || shown_->height() != height) {
+        shown_.reset(new Framebuffer(width, height));
+        previous_.reset(new Framebuffer(width, height));
+        held_frames_.assign(width * height, 0);
+        shown_->CopyFrom(frame);
+        *previous = nullptr;
+        return *shown_;
+    }
+
+    std::swap(shown_, previous_);
+    uint8_t *held = held_frames_.data();
+    for (int y = 0; y < height; ++y) {
+        const Framebuffer::rgb_t *in = frame.row(y);
+        const Framebuffer::rgb_t *before = previous_->row(y);
+        Framebuffer::rgb_t *out = shown_->row(y);
+        for (int x = 0; x < width; ++x, ++held) {
+            if (in[x] == before[x]) {
+                out[x] = before[x];
+                *held = 0;
+            } else if (ColorDistance(in[x], before[x]) > threshold_
+                       || ++*held >= refresh_frames_) {
+                out[x] = in[x];
+                *held = 0;
+            } else {
+                out[x] = before[x];
+            }
+        }
+    }
+    *previous = previous_.get();
+    return *shown_;
+}
+}  // namespace timg
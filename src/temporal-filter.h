@@ -0,0 +1,59 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef TEMPORAL_FILTER_H_
+#define TEMPORAL_FILTER_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "terminal-canvas.h"
+
+namespace timg {
+// Suppresses small changes between consecutive frames of a video, such as
+// the noise compression leaves in static areas, so that only the cells
+// that really changed need to be sent.
+// A pixel is updated as soon as it differs by more than a threshold from
+// what was shown last. Smaller differences are held back until they have
+// been there for a number of frames, so that slow drifts still arrive.
+class TemporalFilter {
+public:
+    // "threshold" is the largest difference in any color channel that is
+    // held back, for up to "refresh_frames".
+    TemporalFilter(int threshold, int refresh_frames);
+
+    // Forget what has been shown, e.g. after the screen has been changed
+    // otherwise. The next frame is taken as it is.
+    void Reset();
+
+    // Filter the next "frame" and return what is to be shown now. The
+    // frame shown before is stored in "previous", or nullptr if there is
+    // none of the same size to compare with; both stay valid until the
+    // next call.
+    const Framebuffer &Apply(const Framebuffer &frame,
+                             const Framebuffer **previous);
+
+private:
+    const int threshold_;
+    const int refresh_frames_;
+    std::unique_ptr<Framebuffer> shown_;     // What is on the screen.
+    std::unique_ptr<Framebuffer> previous_;  // What was before.
+    std::vector<uint8_t> held_frames_;       // Per pixel: how long held back.
+};
+}  // namespace timg
+
+#endif  // TEMPORAL_FILTER_H_
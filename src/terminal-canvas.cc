@@ -23,12 +23,18 @@
 
 namespace timg {
 Framebuffer::Framebuffer(int w, int h)
-    : width_(w), height_(h), pixels_(new rgb_t [ width_ * height_]) {
+    : width_(w), height_(h), pixels_(new rgb_t [ width_ * height_]),
+      owns_pixels_(true) {
     memset(pixels_, 0, sizeof(*pixels_) * width_ * height_);
 }
 
+Framebuffer::Framebuffer(int w, int h, const rgb_t *external_pixels)
+    : width_(w), height_(h), pixels_(const_cast<rgb_t*>(external_pixels)),
+      owns_pixels_(false) {
+}
+
 Framebuffer::~Framebuffer() {
-    delete [] pixels_;
+    if (owns_pixels_) delete [] pixels_;
 }
 
 void Framebuffer::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
@@ -45,8 +51,15 @@ Framebuffer::rgb_t Framebuffer::at(int x, int y) const {
     return pixels_[width_ * y + x];
 }
 
-#define SCREEN_CLEAR            "\033c"
+void Framebuffer::CopyFrom(const Framebuffer &other) {
+    assert(other.width() == width() && other.height() == height());
+    memcpy(pixels_, other.pixels_, sizeof(*pixels_) * width_ * height_);
+}
+
+#define SCREEN_CLEAR            "\033[2J\033[H"  // Clear and cursor home.
+#define SCREEN_CLEAR_BELOW      "\033[J"   // Clear from cursor to the end.
 #define SCREEN_CURSOR_UP_FORMAT "\033[%dA"  // Move cursor up given lines.
+#define SCREEN_CURSOR_DOWN_FORMAT "\033[%dB"  // Move cursor down given lines.
 
 // Interestingly, cursor-on does not take effect until the next newline on
 // the tested terminals. Not sure why that is, but adding a newline sounds
@@ -142,20 +155,16 @@ static inline char *str_append(char *pos, const char *value, size_t len) {
     return pos + len;
 }
 
-// Append two rows of pixels at once, by writing a half-block character with
-// foreground/background.
-static char *AppendDoubleRow(
-    char *pos, int indent, int width,
+// Append "width" character cells, each showing two pixels at once by writing
+// a half-block character with foreground/background.
+static char *AppendCells(
+    char *pos, int width,
     const Framebuffer::rgb_t *top_line,    const char *set_top_pixel_color,
     const Framebuffer::rgb_t *bottom_line, const char *set_btm_pixel_color,
     const char *pixel_glyph) {
     static constexpr char kStartEscape[] = "\033[";
     Framebuffer::rgb_t last_top_color = 0xff000000;  // Guaranteed != first
     Framebuffer::rgb_t last_bottom_color = 0xff000000;
-    if (indent > 0) {
-        memset(pos, ' ', indent);
-        pos += indent;
-    }
     for (int x = 0; x < width; ++x) {
         bool color_emitted = false;
         if (top_line) {
@@ -186,13 +195,39 @@ static char *AppendDoubleRow(
         }
         pos = str_append(pos, pixel_glyph, PIXEL_BLOCK_CHARACTER_LEN);
     }
+    return pos;
+}
 
+// Append two rows of pixels at once as one full line of text.
+static char *AppendDoubleRow(
+    char *pos, int indent, int width,
+    const Framebuffer::rgb_t *top_line,    const char *set_top_pixel_color,
+    const Framebuffer::rgb_t *bottom_line, const char *set_btm_pixel_color,
+    const char *pixel_glyph) {
+    if (indent > 0) {
+        memset(pos, ' ', indent);
+        pos += indent;
+    }
+    pos = AppendCells(pos, width,
+                      top_line, set_top_pixel_color,
+                      bottom_line, set_btm_pixel_color,
+                      pixel_glyph);
     pos = str_append(pos, SCREEN_END_OF_LINE, SCREEN_END_OF_LINE_LEN);
-
     return pos;
 }
 
 void TerminalCanvas::Send(const Framebuffer &framebuffer, int indent) {
+    size_t len;
+    const char *data = Encode(framebuffer, indent, &len);
+    reliable_write(fd_, data, len);
+}
+
+void TerminalCanvas::SendEncoded(const char *data, size_t len) {
+    reliable_write(fd_, data, len);
+}
+
+const char *TerminalCanvas::Encode(const Framebuffer &framebuffer, int indent,
+                                   size_t *len) {
     const int width = framebuffer.width();
     const int height = framebuffer.height();
     char *const start_buffer = EnsureBuffer(width, height, indent);
@@ -222,7 +257,87 @@ void TerminalCanvas::Send(const Framebuffer &framebuffer, int indent) {
                               bottom_line, set_lower_color_,
                               pixel_character_);
     }
-    reliable_write(fd_, start_buffer, pos - start_buffer);
+    *len = pos - start_buffer;
+    return start_buffer;
+}
+
+void TerminalCanvas::SendDifference(const Framebuffer &framebuffer,
+                                    const Framebuffer &previous,
+                                    int indent) {
+    size_t len;
+    const char *data = EncodeDifference(framebuffer, previous, indent, &len);
+    reliable_write(fd_, data, len);
+}
+
+const char *TerminalCanvas::EncodeDifference(const Framebuffer &framebuffer,
+                                             const Framebuffer &previous,
+                                             int indent, size_t *len) {
+    const int width = framebuffer.width();
+    const int height = framebuffer.height();
+    if (previous.width() != width || previous.height() != height) {
+        return Encode(framebuffer, indent, len);
+    }
+
+    // Jumping to a column costs about as much as a few unchanged cells
+    // re-emitted in between two changed ones, so short gaps are just
+    // bridged by sending these cells again.
+    static constexpr int kMaxBridgedCells = 2;
+    static const int kMaxJumpLen = strlen("\033[12345G");
+    const int max_runs = width / (kMaxBridgedCells + 2) + 1;
+    char *const start_buffer = EnsureBuffer(width, height,
+                                            indent + max_runs * kMaxJumpLen);
+    char *pos = start_buffer;
+
+    // Same row layout as in Encode().
+    const bool needs_empty_line = (height % 2 != 0);
+    const int row_offset = (needs_empty_line && top_optional_blank_) ? -1 : 0;
+
+    for (int y = 0; y < height; y+=2) {
+        const int row = y + row_offset;
+        const Framebuffer::rgb_t *top_line = nullptr, *prev_top = nullptr;
+        const Framebuffer::rgb_t *bottom_line = nullptr, *prev_bottom = nullptr;
+        if (row >= 0) {
+            top_line = framebuffer.row(row);
+            prev_top = previous.row(row);
+        }
+        if (row + 1 < height) {
+            bottom_line = framebuffer.row(row + 1);
+            prev_bottom = previous.row(row + 1);
+        }
+        auto cell_changed = [&](int x) {
+            return ((top_line && top_line[x] != prev_top[x]) ||
+                    (bottom_line && bottom_line[x] != prev_bottom[x]));
+        };
+
+        bool line_touched = false;
+        for (int x = 0; x < width; /**/) {
+            if (!cell_changed(x)) {
+                ++x;
+                continue;
+            }
+            int end = x + 1;
+            for (int probe = end;
+                 probe < width && probe - end <= kMaxBridgedCells; ++probe) {
+                if (cell_changed(probe)) end = probe + 1;
+            }
+            pos += sprintf(pos, "\033[%dG", indent + x + 1);
+            pos = AppendCells(pos, end - x,
+                              top_line ? top_line + x : nullptr,
+                              set_upper_color_,
+                              bottom_line ? bottom_line + x : nullptr,
+                              set_lower_color_,
+                              pixel_character_);
+            line_touched = true;
+            x = end;
+        }
+        if (line_touched) {
+            pos = str_append(pos, SCREEN_END_OF_LINE, SCREEN_END_OF_LINE_LEN);
+        } else {
+            *pos++ = '\n';
+        }
+    }
+    *len = pos - start_buffer;
+    return start_buffer;
 }
 
 void TerminalCanvas::JumpUpPixels(int pixels) {
@@ -230,10 +345,19 @@ void TerminalCanvas::JumpUpPixels(int pixels) {
     dprintf(fd_, SCREEN_CURSOR_UP_FORMAT, (pixels+1)/2);
 }
 
+void TerminalCanvas::JumpDownPixels(int pixels) {
+    if (pixels <= 0) return;
+    dprintf(fd_, SCREEN_CURSOR_DOWN_FORMAT, (pixels+1)/2);
+}
+
 void TerminalCanvas::ClearScreen() {
     reliable_write(fd_, SCREEN_CLEAR, strlen(SCREEN_CLEAR));
 }
 
+void TerminalCanvas::ClearBelow() {
+    reliable_write(fd_, SCREEN_CLEAR_BELOW, strlen(SCREEN_CLEAR_BELOW));
+}
+
 void TerminalCanvas::CursorOff() {
     reliable_write(fd_, CURSOR_OFF, strlen(CURSOR_OFF));
 }
@@ -28,6 +28,12 @@ public:
     typedef uint32_t rgb_t;
 
     Framebuffer(int width, int height);
+
+    // A framebuffer for pixels that live elsewhere, e.g. in shared memory,
+    // with rows following each other without gaps. Pixels are not copied
+    // and not freed; if they're read-only, only use it for reading.
+    Framebuffer(int width, int height, const rgb_t *external_pixels);
+
     Framebuffer() = delete;
     Framebuffer(const Framebuffer &other) = delete;
     ~Framebuffer();
@@ -36,14 +42,22 @@ public:
     void SetPixel(int x, int y, rgb_t value);
     rgb_t at(int x, int y) const;
 
+    // Copy all pixels from "other", which has to have the same size.
+    void CopyFrom(const Framebuffer &other);
+
     inline int width() const { return width_; }
     inline int height() const { return height_; }
 
+    // Direct access to the pixels of row "y" for bulk operations.
+    inline rgb_t *row(int y) { return pixels_ + width_ * y; }
+    inline const rgb_t *row(int y) const { return pixels_ + width_ * y; }
+
 private:
     friend class TerminalCanvas;
     const int width_;
     const int height_;
     rgb_t *const pixels_;
+    const bool owns_pixels_;
 };
 
 // Canvas that can send a framebuffer to a terminal.
@@ -58,10 +72,39 @@ public:
     // Send frame to terminal.
     void Send(const Framebuffer &framebuffer, int horizontal_indent);
 
+    // Encode frame into the same byte sequence Send() would write, but
+    // don't write it. Returns a pointer to an internal buffer that stays
+    // valid until the next Encode() or Send(); its length is stored in "len".
+    const char *Encode(const Framebuffer &framebuffer, int horizontal_indent,
+                       size_t *len);
+
+    // Like Send(), but only update the character cells that differ from
+    // "previous", the frame of the same size currently shown at the same
+    // place. Cursor movement is the same as with Send().
+    void SendDifference(const Framebuffer &framebuffer,
+                        const Framebuffer &previous, int horizontal_indent);
+
+    // Encode what SendDifference() would write. Same buffer semantics as
+    // Encode(); falls back to a full encoding if the sizes don't match.
+    const char *EncodeDifference(const Framebuffer &framebuffer,
+                                 const Framebuffer &previous,
+                                 int horizontal_indent, size_t *len);
+
+    // Write bytes as-is to the terminal, e.g. what was obtained from
+    // Encode() before.
+    void SendEncoded(const char *data, size_t len);
+
     // Move cursor up give number of pixels.
     void JumpUpPixels(int pixels);
 
+    // Move cursor down given number of pixels, over lines already shown.
+    void JumpDownPixels(int pixels);
+
     void ClearScreen();
+
+    // Clear everything from the cursor to the end of the screen.
+    void ClearBelow();
+
     void CursorOff();
     void CursorOn();
 
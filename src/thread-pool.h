@@ -0,0 +1,100 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace timg {
+// Simple fixed-size pool of worker threads executing work in the order it
+// has been submitted.
+class ThreadPool {
+public:
+    // Create pool with "count" threads. Zero: one per available CPU.
+    explicit ThreadPool(int count = 0) {
+        if (count <= 0) count = std::thread::hardware_concurrency();
+        if (count <= 0) count = 1;
+        for (int i = 0; i < count; ++i) {
+            threads_.push_back(new std::thread(&ThreadPool::Run, this));
+        }
+    }
+    ThreadPool(const ThreadPool &) = delete;
+
+    // Work not started yet is dropped, work in progress is finished.
+    ~ThreadPool() {
+        {
+            std::unique_lock<std::mutex> l(lock_);
+            exiting_ = true;
+            work_queue_.clear();
+        }
+        cv_.notify_all();
+        for (std::thread *t : threads_) {
+            t->join();
+            delete t;
+        }
+    }
+
+    int size() const { return (int)threads_.size(); }
+
+    // Schedule "f" to be executed on one of the threads. The returned future
+    // provides the result.
+    template <class F>
+    std::future<typename std::result_of<F()>::type> ExecAsync(F f) {
+        typedef typename std::result_of<F()>::type Result;
+        auto task = std::make_shared<std::packaged_task<Result()>>(f);
+        std::future<Result> result = task->get_future();
+        {
+            std::unique_lock<std::mutex> l(lock_);
+            work_queue_.push_back([task]() { (*task)(); });
+        }
+        cv_.notify_one();
+        return result;
+    }
+
+private:
+    void Run() {
+        for (;;) {
+            std::function<void()> work;
+            {
+                std::unique_lock<std::mutex> l(lock_);
+                cv_.wait(l, [this]() {
+                        return exiting_ || !work_queue_.empty();
+                    });
+                if (exiting_) return;
+                work = work_queue_.front();
+                work_queue_.pop_front();
+            }
+            work();
+        }
+    }
+
+    std::vector<std::thread *> threads_;
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> work_queue_;
+    bool exiting_ = false;
+};
+}  // namespace timg
+
+#endif  // THREAD_POOL_H_
@@ -40,7 +40,7 @@ public:
         return Duration(ms / 1000, (ms % 1000) * 1000000);
     }
     static constexpr Duration Micros(long usec) {
-        return Duration(usec / 1000, (usec % 1000000) * 1000);
+        return Duration(usec / 1000000, (usec % 1000000) * 1000);
     }
     static constexpr Duration Nanos(long nanos) {
         return Duration(nanos / 1000000000, nanos % 1000000000);
@@ -51,6 +51,10 @@ public:
 
     struct timespec duration() const { return duration_; }
 
+    inline int64_t nanoseconds() const {
+        return (int64_t)duration_.tv_sec * 1000000000 + duration_.tv_nsec;
+    }
+
 private:
     constexpr Duration(long sec, long ns) : duration_({sec, ns}) {}
     struct timespec duration_;
@@ -73,10 +77,18 @@ public:
 
     Time(const Time &other) : time_(other.time_) {}
 
+    Time &operator=(const Time &other) {
+        time_ = other.time_;
+        return *this;
+    }
+
     inline int64_t nanoseconds() const {
         return (int64_t)time_.tv_sec * 1000000000 + time_.tv_nsec;
     }
 
+    // Absolute time on the monotonic clock, e.g. for timerfd_settime().
+    struct timespec time() const { return time_; }
+
     bool operator <(const Time &other) const {
         if (time_.tv_sec > other.time_.tv_sec) return false;
         if (time_.tv_sec < other.time_.tv_sec) return true;
@@ -18,22 +18,41 @@
 // To compile this image viewer, first get image-magick development files
 // $ sudo apt-get install libgraphicsmagick++-dev
 #include "timg-version.h"
+#include "event-loop.h"
 #include "terminal-canvas.h"
 #include "timg-time.h"
 
+#include "contact-sheet.h"
+#include "fast-decoder.h"
+#include "file-content.h"
+#include "file-prefetcher.h"
+#include "image-browser.h"
 #include "image-display.h"
+#include "image-sequence.h"
+#include "image-stream.h"
+#include "large-image.h"
+#include "mosaic.h"
+#include "raw-video.h"
+#include "shm-video.h"
+#include "thread-pool.h"
+#include "watch-display.h"
+#include "zoom-viewer.h"
 #ifdef WITH_TIMG_VIDEO
 #  include "video-display.h"
 #endif
 
+#include <getopt.h>
 #include <math.h>
-#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <Magick++.h>
 
 #ifndef TIMG_VERSION
@@ -43,11 +62,6 @@
 using timg::Duration;
 using timg::Time;
 
-volatile sig_atomic_t interrupt_received = 0;
-static void InterruptHandler(int signo) {
-  interrupt_received = 1;
-}
-
 static int usage(const char *progname, int w, int h) {
 #ifdef WITH_TIMG_VIDEO
     static constexpr char kFileType[] = "image/video";
@@ -80,6 +94,31 @@ static int usage(const char *progname, int w, int h) {
             "\t-F         : Print filename before showing images.\n"
             "\t-E         : Don't hide the cursor while showing images.\n"
             "\t-v         : Print version and exit.\n"
+            "\t--zoom     : Interactive: zoom (+/-) and pan (cursor keys) "
+            "in image.\n"
+            "\t--browse[=<MiB>] : Interactive: browse images with n/p, "
+            "up/down, home/end\n"
+            "\t             or <number><enter>. Keeps up to MiB of "
+            "prepared images (256).\n"
+            "\t--grid=<cols>[x<rows>] : Show images as thumbnails in a grid "
+            "with filenames.\n"
+            "\t--mosaic   : Play all videos and animations at once, tiled "
+            "in one picture.\n"
+            "\t--watch    : Keep showing images and update them when the "
+            "files change.\n"
+            "\t--raw=<format> : Input is a stream of raw frames, e.g. from "
+            "a pipe. Format is\n"
+            "\t             rgb24|bgr24|rgba|bgra:<w>x<h>[@<fps>] or "
+            "y4m[@<fps>].\n"
+            "\t--stream   : Input is a stream of concatenated JPEG or PNG "
+            "images (e.g. MJPEG).\n"
+            "\t--shm      : Arguments are names of shared memory frame rings "
+            "to show\n"
+            "\t             (see shm-frame-ring.h).\n"
+            "\t--sequence=<fps> : Play all images as one animation; "
+            "arguments can be\n"
+            "\t             printf patterns (frame%%04d.png) or globs "
+            "('frame*.png').\n"
 
             "\n  Scrolling\n"
             "\t-s[<ms>]   : Scroll horizontally (optionally: delay ms (60)).\n"
@@ -89,14 +128,47 @@ static int usage(const char *progname, int w, int h) {
             "\t-t<seconds>: Stop after this time.\n"
             "\t-c<num>    : Number of runs through a full cycle.\n"
             "\t-f<num>    : Only animation: number of frames to render.\n"
+#ifdef WITH_TIMG_VIDEO
+            "\t--rewind-buffer=<MiB> : Only video: memory to keep recently "
+            "shown\n"
+            "\t             frames for stepping backward (default: 0 = off).\n"
+            "\t--hysteresis=<n> : Only video: only send cells that changed; "
+            "hold back\n"
+            "\t             color changes up to n (0..255) for about a second, "
+            "to\n"
+            "\t             suppress compression flicker (default: 0 = off).\n"
+#endif
 
             "\nIf both -c and -t are given, whatever comes first stops.\n"
             "If both -w and -t are given for some animation/scroll, -t "
-            "takes precedence\n",
+            "takes precedence\n"
+
+            "\nKeys while showing animations, videos or scrolling:\n"
+            "\t<space> pause/resume; '.' or ',' step forward/backward;\n"
+            "\t<right>/<left> seek forward/backward; 'q' quit.\n",
             w, h);
     return 1;
 }
 
+// Options that only exist in their long form; values chosen to not collide
+// with any of the short option characters.
+enum LongOptionIds {
+    OPT_REWIND_BUFFER = 1000,
+    OPT_ZOOM,
+    OPT_BROWSE,
+    OPT_GRID,
+    OPT_MOSAIC,
+    OPT_WATCH,
+    OPT_RAW,
+    OPT_SHM,
+    OPT_STREAM,
+    OPT_SEQUENCE,
+    OPT_HYSTERESIS,
+};
+
+// Beyond this, Magick keeps pixels of images in disk backed caches.
+static constexpr size_t kMagickMemoryLimit = 512 << 20;
+
 static bool GetBoolenEnv(const char *env_name) {
     const char *const value = getenv(env_name);
     return value && atoi(value) != 0;
@@ -104,6 +176,7 @@ static bool GetBoolenEnv(const char *env_name) {
 
 int main(int argc, char *argv[]) {
     Magick::InitializeMagick(*argv);
+    timg::LimitMagickMemory(kMagickMemoryLimit);
 
     struct winsize w = {};
     const bool winsize_success = (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == 0);
@@ -129,16 +202,47 @@ int main(int argc, char *argv[]) {
     int dx = 1;
     int dy = 0;
     bool fit_width = false;
+    bool geometry_from_terminal = true;  // Follow terminal resizes.
     bool do_image_loading = true;
+    size_t rewind_buffer_bytes = 0;
+    int video_hysteresis = 0;
+    bool do_zoom = false;
+    bool do_browse = false;
+    size_t browse_cache_bytes = 256 << 20;
+    int grid_cols = 0;
+    int grid_rows = 0;
+    bool do_mosaic = false;
+    bool do_watch = false;
+    const char *raw_format = nullptr;
+    bool do_shm = false;
+    bool do_stream = false;
+    float sequence_fps = 0;  // Non-zero: play files as one image sequence.
+
+    static constexpr struct option long_options[] = {
+        { "rewind-buffer", required_argument, NULL, OPT_REWIND_BUFFER },
+        { "zoom",          no_argument,       NULL, OPT_ZOOM },
+        { "browse",        optional_argument, NULL, OPT_BROWSE },
+        { "grid",          required_argument, NULL, OPT_GRID },
+        { "mosaic",        no_argument,       NULL, OPT_MOSAIC },
+        { "watch",         no_argument,       NULL, OPT_WATCH },
+        { "raw",           required_argument, NULL, OPT_RAW },
+        { "shm",           no_argument,       NULL, OPT_SHM },
+        { "stream",        no_argument,       NULL, OPT_STREAM },
+        { "sequence",      required_argument, NULL, OPT_SEQUENCE },
+        { "hysteresis",    required_argument, NULL, OPT_HYSTERESIS },
+        { 0, 0, 0, 0 },
+    };
 
     int opt;
-    while ((opt = getopt(argc, argv, "vg:s::w:t:c:f:b:B:T::hCFEd:UWaV"))!=-1) {
+    while ((opt = getopt_long(argc, argv, "vg:s::w:t:c:f:b:B:T::hCFEd:UWaV",
+                              long_options, NULL)) != -1) {
         switch (opt) {
         case 'g':
             if (sscanf(optarg, "%dx%d", &width, &height) < 2) {
                 fprintf(stderr, "Invalid size spec '%s'", optarg);
                 return usage(argv[0], term_width, term_height);
             }
+            geometry_from_terminal = false;
             break;
         case 'w':
             between_images_duration
@@ -175,6 +279,60 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "-V: Video support not compiled in\n");
 #endif
             break;
+        case OPT_REWIND_BUFFER:
+#ifdef WITH_TIMG_VIDEO
+            rewind_buffer_bytes = (size_t)(atof(optarg) * 1024 * 1024);
+#else
+            fprintf(stderr, "--rewind-buffer: Video support not compiled in\n");
+#endif
+            break;
+        case OPT_HYSTERESIS:
+#ifdef WITH_TIMG_VIDEO
+            video_hysteresis = std::min(255, std::max(0, atoi(optarg)));
+#else
+            fprintf(stderr, "--hysteresis: Video support not compiled in\n");
+#endif
+            break;
+        case OPT_ZOOM:
+            do_zoom = true;
+            break;
+        case OPT_GRID:
+            if (sscanf(optarg, "%dx%d", &grid_cols, &grid_rows) < 1
+                || grid_cols < 1) {
+                fprintf(stderr, "--grid=%s: expected number of columns, "
+                        "optionally followed by x<rows>\n", optarg);
+                return usage(argv[0], term_width, term_height);
+            }
+            break;
+        case OPT_MOSAIC:
+            do_mosaic = true;
+            break;
+        case OPT_WATCH:
+            do_watch = true;
+            break;
+        case OPT_RAW:
+            raw_format = optarg;
+            break;
+        case OPT_SHM:
+            do_shm = true;
+            break;
+        case OPT_STREAM:
+            do_stream = true;
+            break;
+        case OPT_SEQUENCE:
+            sequence_fps = atof(optarg);
+            if (sequence_fps <= 0) {
+                fprintf(stderr, "--sequence=%s: expected frames per second\n",
+                        optarg);
+                return usage(argv[0], term_width, term_height);
+            }
+            break;
+        case OPT_BROWSE:
+            do_browse = true;
+            if (optarg) {
+                browse_cache_bytes = (size_t)(atof(optarg) * 1024 * 1024);
+            }
+            break;
         case 'd':
             if (sscanf(optarg, "%d:%d", &dx, &dy) < 1) {
                 fprintf(stderr, "-d%s: At least dx paramter needed e.g. -d1."
@@ -250,44 +408,223 @@ int main(int argc, char *argv[]) {
     display_opts.fill_height = do_scroll && dx != 0; // scroll hor, fill vert
     int exit_code = 0;
 
-    signal(SIGTERM, InterruptHandler);
-    signal(SIGINT, InterruptHandler);
+    // Keys are only read if stdin is a terminal, not if it brings in data.
+    timg::EventLoop event_loop;
+    if (!event_loop.Init(STDIN_FILENO)) {
+        fprintf(stderr, "Can't set up event handling.\n");
+        return 1;
+    }
+    // Only if we follow the terminal size, images need to be re-layouted.
+    const bool tracks_terminal = geometry_from_terminal
+        && event_loop.TrackTerminalSize(STDOUT_FILENO);
 
     timg::TerminalCanvas canvas(STDOUT_FILENO, terminal_use_upper_block);
     if (hide_cursor) {
         canvas.CursorOff();
     }
 
-    for (int imgarg = optind; imgarg < argc && !interrupt_received; ++imgarg) {
+    if (do_browse && !event_loop.interactive()) {
+        fprintf(stderr, "--browse needs keyboard input from a terminal.\n");
+        do_browse = false;
+    }
+    if (grid_cols > 0) {
+        timg::ThreadPool pool;
+        const std::vector<const char *> files(argv + optind, argv + argc);
+        if (!timg::ShowContactSheet(files, grid_cols, grid_rows,
+                                    width, height, display_opts,
+                                    bg_color, pattern_color,
+                                    &pool, &event_loop, &canvas)) {
+            exit_code = 1;
+        }
+        optind = argc;  // All done.
+    } else if (do_mosaic) {
+        const std::vector<const char *> files(argv + optind, argv + argc);
+        if (!timg::PlayMosaic(files, width, height, display_opts,
+                              bg_color, pattern_color, duration, loops,
+                              &event_loop, &canvas)) {
+            exit_code = 1;
+        }
+        optind = argc;  // All done.
+    } else if (sequence_fps > 0) {
+        std::vector<std::string> files;
+        if (timg::ExpandImageSequence(
+                std::vector<const char *>(argv + optind, argv + argc),
+                &files)) {
+            timg::ThreadPool pool;
+            timg::ImageSequence sequence(files, sequence_fps, width, height,
+                                         display_opts, bg_color,
+                                         pattern_color, &pool);
+            timg::PlayFrames(&sequence, duration, max_frames, loops,
+                             &event_loop, &canvas);
+        } else {
+            exit_code = 1;
+        }
+        optind = argc;  // All done.
+    } else if (do_watch) {
+        const std::vector<const char *> files(argv + optind, argv + argc);
+        if (!timg::WatchAndDisplay(files, width, height, display_opts,
+                                   bg_color, pattern_color, show_filename,
+                                   duration, &event_loop, &canvas)) {
+            exit_code = 1;
+        }
+        optind = argc;  // All done.
+    } else if (do_browse) {
+        timg::ThreadPool pool;
+        const std::vector<const char *> files(argv + optind, argv + argc);
+        timg::ImageBrowser browser(files, width, height, display_opts,
+                                   bg_color, pattern_color,
+                                   browse_cache_bytes, &pool);
+        browser.Run(duration, max_frames, loops, &event_loop, &canvas);
+        optind = argc;  // All done.
+    }
+
+    // With many images to go through, read the next files while we're
+    // busy with the current one.
+    std::unique_ptr<timg::FilePrefetcher> prefetcher;
+    if (argc - optind > 1 && do_image_loading && !do_zoom && !raw_format
+        && !do_stream && !do_shm) {
+        prefetcher.reset(new timg::FilePrefetcher(
+                             std::vector<const char *>(argv + optind,
+                                                       argv + argc)));
+    }
+    const int first_file = optind;
+
+    for (int imgarg = optind;
+         imgarg < argc && !event_loop.interrupted();
+         ++imgarg) {
         const char *filename = argv[imgarg];
+        std::shared_ptr<const timg::FileContent> content;
+        if (prefetcher) content = prefetcher->Get(imgarg - first_file);
+        if (geometry_from_terminal && event_loop.terminal_pixel_width() > 0) {
+            width = event_loop.terminal_pixel_width();
+            height = event_loop.terminal_pixel_height();
+        }
         if (do_clear) canvas.ClearScreen();
         if (show_filename) {
             printf("%s\n", filename);
         }
 
+        if (do_zoom) {
+            timg::ThreadPool pool;
+            timg::ZoomViewer viewer;
+            if (viewer.Load(filename, &pool)) {
+                viewer.Run(width, height, &event_loop, &canvas);
+                continue;
+            }
+        }
+
+        if (raw_format) {
+            timg::RawVideoLoader raw_loader;
+            if (raw_loader.LoadAndScale(filename, raw_format, width, height,
+                                        display_opts)) {
+                raw_loader.Play(duration, max_frames, &event_loop, &canvas);
+            } else {
+                exit_code = 1;
+            }
+            continue;
+        }
+
+        if (do_stream) {
+            timg::ImageStreamLoader stream_loader;
+            if (stream_loader.LoadAndScale(filename, width, height,
+                                           display_opts)) {
+                stream_loader.Play(duration, max_frames, &event_loop, &canvas);
+            } else {
+                exit_code = 1;
+            }
+            continue;
+        }
+
+        if (do_shm) {
+            timg::ShmVideoLoader shm_loader;
+            if (shm_loader.LoadAndScale(filename, width, height,
+                                        display_opts)) {
+                shm_loader.Play(duration, max_frames, &event_loop, &canvas);
+            } else {
+                exit_code = 1;
+            }
+            continue;
+        }
+
+        // Documents are shown page by page as they are loaded.
+        if (do_image_loading && !do_scroll
+            && timg::PagedDocument::IsPagedDocument(filename)) {
+            timg::ThreadPool pool(1);   // Only reads one page ahead.
+            timg::PagedDocument document(width, height, display_opts,
+                                         bg_color, pattern_color, &pool);
+            if (document.Load(filename)) {
+                timg::PlayFrames(&document, duration, max_frames, 1,
+                                 &event_loop, &canvas);
+                const Time next = Time::Now() + between_images_duration;
+                while (event_loop.WaitBetweenImages(next)
+                       == timg::EventLoop::Event::kResize) {
+                }
+                continue;
+            }
+        }
+
         if (do_image_loading) {
+            // Large JPEGs are shown coarsely right away, then refined in
+            // place once they are loaded.
+            std::unique_ptr<timg::Framebuffer> preview;
+            if (!do_scroll && display_opts.crop_border == 0
+                && !display_opts.auto_trim_image) {
+                if (!content) content = timg::FileContent::Open(filename);
+                if (content) {
+                    preview.reset(timg::DecodePreview(*content, width, height,
+                                                      display_opts));
+                }
+            }
+            if (preview) {
+                canvas.Send(*preview, display_opts.center_horizontally
+                            ? (width - preview->width()) / 2 : 0);
+            }
+
             timg::ImageLoader image_loader;
+            image_loader.SetContent(content);
+            if (do_scroll) {
+                image_loader.PrepareForScrolling();
+            } else {
+                if (tracks_terminal) image_loader.KeepSourceForRescale();
+                image_loader.SetPlaybackLimits(max_frames, duration);
+            }
             if (image_loader.LoadAndScale(filename, width, height,
                                           display_opts,
                                           bg_color, pattern_color)) {
                 if (do_scroll) {
-                    image_loader.Scroll(duration, loops, interrupt_received,
+                    image_loader.Scroll(duration, loops, &event_loop,
                                         dx, dy, scroll_delay, &canvas);
+                } else if (preview && !image_loader.is_animation()) {
+                    image_loader.DisplayOver(*preview, &canvas);
                 } else {
                     image_loader.Display(duration, max_frames, loops,
-                                         interrupt_received, &canvas);
+                                         &event_loop, &canvas);
                 }
                 if (!image_loader.is_animation()) {
-                    (Time::Now() + between_images_duration).WaitUntil();
+                    const Time next = Time::Now() + between_images_duration;
+                    while (event_loop.WaitBetweenImages(next)
+                           == timg::EventLoop::Event::kResize) {
+                        if (!do_scroll && image_loader.Rescale(
+                                event_loop.terminal_pixel_width(),
+                                event_loop.terminal_pixel_height())) {
+                            canvas.ClearScreen();
+                            image_loader.Display(duration, max_frames, loops,
+                                                 &event_loop, &canvas);
+                        }
+                    }
                 }
                 continue;
             }
         }
 
 #ifdef WITH_TIMG_VIDEO
-        timg::VideoLoader video_loader;
+        // Not an image. The video loader maps the file itself, so don't keep
+        // what has been read for the image loader during playback.
+        content.reset();
+        timg::VideoLoader video_loader(rewind_buffer_bytes);
         if (video_loader.LoadAndScale(filename, width, height, display_opts)) {
-            video_loader.Play(duration, interrupt_received, &canvas);
+            video_loader.SetHysteresis(video_hysteresis);
+            video_loader.Play(duration, &event_loop, &canvas);
             continue;
         }
 #endif
@@ -295,18 +632,12 @@ int main(int argc, char *argv[]) {
         // We either loaded, played and continue'ed, or we end up here.
         fprintf(stderr, "%s: couldn't load\n", filename);
         exit_code = 1;
-#ifdef WITH_TIMG_VIDEO
-        if (strcmp(filename, "-") == 0 || strcmp(filename, "/dev/stdin") == 0) {
-            fprintf(stderr, "If this is a video on stdin, use '-V' to "
-                    "skip image probing\n");
-        }
-#endif
     }
 
     if (hide_cursor) {
         canvas.CursorOn();
     }
-    if (interrupt_received)   // Make 'Ctrl-C' appear on new line.
+    if (event_loop.interrupted())   // Make 'Ctrl-C' appear on new line.
         printf("\n");
 
     return exit_code;
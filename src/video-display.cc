@@ -18,9 +18,16 @@
 
 #include "video-display.h"
 
+#include "event-loop.h"
+#include "file-content.h"
 #include "image-display.h"
+#include "pipe-buffer.h"
 #include "timg-time.h"
 
+#include <errno.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <mutex>
 
 // libav: "U NO extern C in header ?"
@@ -32,6 +39,16 @@ extern "C" {
 }
 
 namespace timg {
+// Size of the buffer libav reads into from our input.
+static constexpr int kIOBufferSize = 256 << 10;
+
+// How far ahead of the current read position we ask the kernel to have
+// mapped files read in.
+static constexpr int64_t kReadAheadBytes = 8 << 20;
+
+// Buffer for a stream coming in on stdin.
+static constexpr size_t kPipeBufferSize = 32 << 20;
+
 // Convert deprecated color formats to new and manually set the color range.
 // YUV has funny ranges (16-235), while the YUVJ are 0-255. SWS prefers to
 // deal with the YUV range, but then requires to set the output range.
@@ -78,19 +95,71 @@ static void OnceInitialize() {
     avformat_network_init();
 }
 
-VideoLoader::VideoLoader() {
+VideoLoader::VideoLoader(size_t rewind_buffer_bytes)
+    : rewind_(rewind_buffer_bytes) {
     static std::once_flag init;
     std::call_once(init, OnceInitialize);
 }
 
 VideoLoader::~VideoLoader() {
+    av_frame_free(&decode_frame_);
+    av_packet_free(&packet_);
     avcodec_close(codec_context_);
     sws_freeContext(sws_context_);
+    if (output_frame_) av_freep(&output_frame_->data[0]);
     av_frame_free(&output_frame_);
     avformat_close_input(&format_context_);
+    if (io_context_) {
+        av_freep(&io_context_->buffer);
+        avio_context_free(&io_context_);
+    }
     delete terminal_fb_;
 }
 
+int VideoLoader::ReadInput(void *loader, uint8_t *buf, int size) {
+    VideoLoader *self = (VideoLoader*)loader;
+    if (self->pipe_) {
+        const int r = self->pipe_->Read(buf, size);
+        return r == 0 ? AVERROR_EOF : (r < 0 ? AVERROR(EIO) : r);
+    }
+    const int64_t available = self->input_->size() - self->input_pos_;
+    if (available <= 0) return AVERROR_EOF;
+    if (size > available) size = available;
+    // Let the kernel read ahead of us.
+    if (self->input_pos_ + kReadAheadBytes / 2 > self->advised_until_) {
+        self->input_->WillNeed(self->input_pos_, kReadAheadBytes);
+        self->advised_until_ = self->input_pos_ + kReadAheadBytes;
+    }
+    memcpy(buf, self->input_->data() + self->input_pos_, size);
+    self->input_pos_ += size;
+    return size;
+}
+
+int64_t VideoLoader::SeekInput(void *loader, int64_t offset, int whence) {
+    VideoLoader *self = (VideoLoader*)loader;
+    if (self->pipe_) {
+        // Only within what is still buffered; size is unknown.
+        switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET: return self->pipe_->Seek(offset);
+        case SEEK_CUR: return self->pipe_->Seek(self->pipe_->position()
+                                                + offset);
+        default: return -1;
+        }
+    }
+    const int64_t size = self->input_->size();
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE: return size;
+    case SEEK_SET: break;
+    case SEEK_CUR: offset += self->input_pos_; break;
+    case SEEK_END: offset += size; break;
+    default: return -1;
+    }
+    if (offset < 0 || offset > size) return -1;
+    self->input_pos_ = offset;
+    self->advised_until_ = 0;  // Read ahead from the new position.
+    return offset;
+}
+
 const char *VideoLoader::VersionInfo() {
     return "libav " AV_STRINGIFY(LIBAVFORMAT_VERSION);
 }
@@ -102,8 +171,30 @@ bool VideoLoader::LoadAndScale(const char *filename,
         filename = "/dev/stdin";
     }
     format_context_ = avformat_alloc_context();
+
+    // Local files are read from a mapping, stdin from what the image loader
+    // has read while probing or through a large buffer filled on its own
+    // thread. Anything else, e.g. URLs, is left to libav.
+    if (FileContent::IsStdin(filename)) {
+        input_ = FileContent::BufferedStdin();
+        if (!input_) pipe_.reset(new PipeBuffer(STDIN_FILENO, kPipeBufferSize));
+    } else {
+        input_ = FileContent::Map(filename);
+    }
+    const char *url = filename;
+    if (input_ || pipe_) {
+        uint8_t *buffer = (uint8_t*)av_malloc(kIOBufferSize);
+        io_context_ = avio_alloc_context(buffer, kIOBufferSize, 0, this,
+                                         &VideoLoader::ReadInput, nullptr,
+                                         &VideoLoader::SeekInput);
+        if (!input_) io_context_->seekable = 0;
+        format_context_->pb = io_context_;
+        format_context_->flags |= AVFMT_FLAG_CUSTOM_IO;
+        url = "";
+    }
+
     int ret;
-    if ((ret = avformat_open_input(&format_context_, filename, NULL, NULL)) != 0) {
+    if ((ret = avformat_open_input(&format_context_, url, NULL, NULL)) != 0) {
         char msg[100];
         av_strerror(ret, msg, sizeof(msg));
         fprintf(stderr, "%s: %s\n", filename, msg);
@@ -140,19 +231,11 @@ bool VideoLoader::LoadAndScale(const char *filename,
     if (avcodec_open2(codec_context_, av_codec, NULL) < 0)
         return false;
 
-    /*
-     * Prepare frame to hold the scaled target frame to be send to matrix.
-     */
-    int target_width = 0;
-    int target_height = 0;
-
-    // Make display fit within canvas using the timg scaling utility.
-    DisplayOptions opts(display_options);
     // Make sure we don't confuse users. Some image URLs actually end up here,
     // so make sure that it is clear certain options won't work.
     // TODO: this is a crude work-around. And while we tell the user what to
     // do, it would be better if we'd dealt with it already.
-    if (opts.crop_border != 0 || opts.auto_trim_image) {
+    if (display_options.crop_border != 0 || display_options.auto_trim_image) {
         const bool is_url = (strncmp(filename, "http://", 7) == 0 ||
                              strncmp(filename, "https://", 8) == 0);
         fprintf(stderr, "%s%s is handled by video subsystem. "
@@ -160,17 +243,40 @@ bool VideoLoader::LoadAndScale(const char *filename,
                 is_url ? "URL " : "", filename);
         if (is_url) {
             fprintf(stderr, "use:\n\twget -qO- %s | timg -T%d -\n... instead "
-                    "for this to work\n", filename, opts.crop_border);
+                    "for this to work\n", filename,
+                    display_options.crop_border);
         }
     }
+    options_ = display_options;
+    return SetupScaling(screen_width, screen_height);
+}
+
+bool VideoLoader::SetupScaling(int screen_width, int screen_height) {
+    /*
+     * Prepare frame to hold the scaled target frame to be send to matrix.
+     */
+    int target_width = 0;
+    int target_height = 0;
+
+    // Make display fit within canvas using the timg scaling utility.
+    DisplayOptions opts(options_);
     opts.fill_height = false;  // This only makes sense for horizontal scroll.
     ScaleToFit(codec_context_->width, codec_context_->height,
                screen_width, screen_height, opts,
                &target_width, &target_height);
 
-    if (display_options.center_horizontally) {
+    center_indentation_ = 0;
+    if (opts.center_horizontally) {
         center_indentation_ = (screen_width - target_width)/2;
     }
+
+    // If this is a re-layout, clean up what we had before.
+    sws_freeContext(sws_context_);
+    if (output_frame_) av_freep(&output_frame_->data[0]);
+    av_frame_free(&output_frame_);
+    delete terminal_fb_;
+    terminal_fb_ = nullptr;
+
     // initialize SWS context for software scaling
     sws_context_ = CreateSWSContext(codec_context_,
                                     target_width, target_height);
@@ -213,36 +319,214 @@ void VideoLoader::CopyToFramebuffer(const AVFrame *av_frame) {
     }
 }
 
+Duration VideoLoader::FramePresentationTime(const AVFrame *av_frame) const {
+    const int64_t ts = av_frame->best_effort_timestamp;
+    if (ts == AV_NOPTS_VALUE) return Duration();
+    const AVRational time_base =
+        format_context_->streams[video_stream_index_]->time_base;
+    return Duration::Nanos(av_rescale_q(ts, time_base, {1, 1000000000}));
+}
+
+bool VideoLoader::DecodeNextFrame(AVPacket *packet, AVFrame *frame) {
+    while (av_read_frame(format_context_, packet) >= 0) {
+        const bool got_frame = (packet->stream_index == video_stream_index_
+                                && DecodePacket(packet, frame));
+        av_packet_unref(packet);  // was allocated by av_read_frame
+        if (got_frame) {
+            last_pts_ = FramePresentationTime(frame);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool VideoLoader::SeekTo(int64_t position_ns,
+                         AVPacket *packet, AVFrame *frame) {
+    if (position_ns < 0) position_ns = 0;
+    const AVRational time_base =
+        format_context_->streams[video_stream_index_]->time_base;
+    const int64_t ts = av_rescale_q(position_ns, {1, 1000000000}, time_base);
+    if (av_seek_frame(format_context_, video_stream_index_, ts,
+                      AVSEEK_FLAG_BACKWARD) < 0) {
+        return false;
+    }
+    avcodec_flush_buffers(codec_context_);
+    rewind_.Clear();  // Not continuous anymore with what comes next.
+
+    // We landed on a keyframe before the position; decode forward. Allow
+    // for half a frame rounding difference.
+    const int64_t target_ns = position_ns - frame_duration_.nanoseconds() / 2;
+    while (DecodeNextFrame(packet, frame)) {
+        if (last_pts_.nanoseconds() >= target_ns)
+            return true;
+    }
+    return false;
+}
+
+void VideoLoader::ScaleFrame(const AVFrame *decoded) {
+    sws_scale(sws_context_,
+              decoded->data, decoded->linesize,
+              0, codec_context_->height,
+              output_frame_->data, output_frame_->linesize);
+    CopyToFramebuffer(output_frame_);
+}
+
+const timg::Framebuffer *VideoLoader::DecodeScaledFrame() {
+    if (!packet_) {
+        packet_ = av_packet_alloc();
+        decode_frame_ = av_frame_alloc();
+    }
+    if (!DecodeNextFrame(packet_, decode_frame_))
+        return nullptr;
+    ScaleFrame(decode_frame_);
+    return terminal_fb_;
+}
+
+void VideoLoader::SetHysteresis(int threshold) {
+    if (threshold <= 0) {
+        filter_.reset();
+        return;
+    }
+    // Small changes show up after about a second.
+    const int64_t frame_ns = std::max((int64_t)1,
+                                      frame_duration_.nanoseconds());
+    const int refresh_frames = (int)std::max((int64_t)1,
+                                             (int64_t)1000000000 / frame_ns);
+    filter_.reset(new TemporalFilter(threshold, refresh_frames));
+}
+
+void VideoLoader::ShowFrame(const AVFrame *decoded,
+                            timg::TerminalCanvas *canvas) {
+    ScaleFrame(decoded);
+    if (!is_first_frame_) canvas->JumpUpPixels(terminal_fb_->height());
+
+    // With hysteresis, what we show is filtered, and we only need to send
+    // what changed from the frame shown before.
+    if (filter_ && is_first_frame_) filter_->Reset();
+    const Framebuffer *previous = nullptr;
+    const Framebuffer &frame = filter_
+        ? filter_->Apply(*terminal_fb_, &previous)
+        : *terminal_fb_;
+    size_t len;
+    const char *data = nullptr;
+    if (rewind_.enabled()) {
+        // Keep the encoded frame around for stepping back. It is shown
+        // on top of anything, so it needs to be complete.
+        data = canvas->Encode(frame, center_indentation_, &len);
+        rewind_.Push(last_pts_, frame.height(), data, len);  // Copies it.
+    }
+    if (previous) {
+        data = canvas->EncodeDifference(frame, *previous, center_indentation_,
+                                        &len);
+    } else if (!data) {
+        data = canvas->Encode(frame, center_indentation_, &len);
+    }
+    canvas->SendEncoded(data, len);
+    is_first_frame_ = false;
+}
+
 void VideoLoader::Play(Duration duration,
-                       const volatile sig_atomic_t &interrupt_received,
+                       timg::EventLoop *event_loop,
                        timg::TerminalCanvas *canvas) {
+    static constexpr int64_t kSeekNanos = 10LL * 1000000000;  // 10 seconds.
+    const int64_t frame_ns = frame_duration_.nanoseconds();
+
+    event_loop->StartPlayback();
     AVPacket *packet = av_packet_alloc();
-    bool is_first = true;
     const Time end_time = Time::Now() + duration;
     AVFrame *decode_frame = av_frame_alloc();  // Decode video into this
     timg::Time end_next_frame;
-    while (Time::Now() < end_time && !interrupt_received
-           && av_read_frame(format_context_, packet) >= 0) {
-        if (packet->stream_index == video_stream_index_) {
-            // Determine absolute end of this frame now so that we don't include
-            // decoding overhead.
-            // TODO: skip frames if getting too much behind ?
-            end_next_frame.Add(frame_duration_);
-
-            // Decode video frame
-            if (DecodePacket(packet, decode_frame)) {
-                sws_scale(sws_context_,
-                          decode_frame->data, decode_frame->linesize,
-                          0, codec_context_->height,
-                          output_frame_->data, output_frame_->linesize);
-                CopyToFramebuffer(output_frame_);
-                if (!is_first) canvas->JumpUpPixels(terminal_fb_->height());
-                canvas->Send(*terminal_fb_, center_indentation_);
-                is_first = false;
+
+    // How many frames we are behind the newest decoded frame while stepping
+    // through the rewind buffer. Zero: the newest.
+    size_t rewind_pos = 0;
+    bool replaying = false;  // Showing frames from the rewind buffer.
+    EventLoop::Command command = EventLoop::Command::kNextFrame;
+    while (Time::Now() < end_time && !event_loop->interrupted()) {
+        const int64_t shown_pts = replaying
+            ? rewind_.Get(rewind_pos).pts.nanoseconds()
+            : last_pts_.nanoseconds();
+        bool do_seek = false;
+        int64_t seek_to = 0;
+        switch (command) {
+        case EventLoop::Command::kQuit:
+        case EventLoop::Command::kExitKey:
+            break;
+        case EventLoop::Command::kStepBackward:
+            if (rewind_pos + 1 < rewind_.size()) {
+                ++rewind_pos;   // Replay from memory below.
+                replaying = true;
+            } else {
+                do_seek = true;   // Beyond what we remember.
+                seek_to = shown_pts - frame_ns;
+            }
+            break;
+        case EventLoop::Command::kSeekForward:
+            do_seek = true;
+            seek_to = shown_pts + kSeekNanos;
+            break;
+        case EventLoop::Command::kSeekBackward:
+            do_seek = true;
+            seek_to = shown_pts - kSeekNanos;
+            break;
+        case EventLoop::Command::kResize:
+            // Re-create scaling for the new size; the next frame will be
+            // shown in the new size. What we remember is of the old size.
+            if (SetupScaling(event_loop->terminal_pixel_width(),
+                             event_loop->terminal_pixel_height())) {
+                canvas->ClearScreen();
+                is_first_frame_ = true;
+                rewind_.Clear();
+                rewind_pos = 0;
+                replaying = false;
+            } else {
+                command = EventLoop::Command::kQuit;
             }
-            end_next_frame.WaitUntil();
+            break;
+        default:
+            // Step toward the newest frame we remember, and only decode
+            // once that has been shown again.
+            if (replaying && rewind_pos > 0)
+                --rewind_pos;
+            else
+                replaying = false;
+            break;
+        }
+        if (command == EventLoop::Command::kQuit ||
+            command == EventLoop::Command::kExitKey) {
+            break;
+        }
+
+        const bool seeked = do_seek && SeekTo(seek_to, packet, decode_frame);
+        if (rewind_pos >= rewind_.size()) {
+            // SeekTo() clears what we remember, even if it fails later on.
+            rewind_pos = 0;
+            replaying = false;
+        }
+        if (seeked) {
+            rewind_pos = 0;
+            replaying = false;
+            ShowFrame(decode_frame, canvas);
+        } else if (replaying) {
+            const RewindBuffer::Frame &frame = rewind_.Get(rewind_pos);
+            canvas->JumpUpPixels(frame.height);
+            canvas->SendEncoded(frame.data.data(), frame.data.size());
+            if (filter_) filter_->Reset();  // Not what it has shown.
+        } else if (!do_seek || command == EventLoop::Command::kSeekForward) {
+            // Regular progress (or not seekable and asked to go forward).
+            if (!DecodeNextFrame(packet, decode_frame))
+                break;
+            ShowFrame(decode_frame, canvas);
+        }
+
+        // Deadlines accumulate frame durations, so that decoding overhead
+        // does not add up.
+        // TODO: skip frames if getting too much behind ?
+        end_next_frame.Add(frame_duration_);
+        command = event_loop->WaitForNextFrame(end_next_frame);
+        if (command == EventLoop::Command::kResume) {
+            end_next_frame = Time::Now();
         }
-        av_packet_unref(packet);  // was allocated by av_read_frame
     }
     av_frame_free(&decode_frame);
     av_packet_free(&packet);
@@ -16,24 +16,34 @@
 #ifndef VIDEO_DISPLAY_H_
 #define VIDEO_DISPLAY_H_
 
-#include <signal.h>
+#include <stdint.h>
 
+#include <memory>
+
+#include "image-display.h"
+#include "rewind-buffer.h"
+#include "temporal-filter.h"
 #include "terminal-canvas.h"
 #include "timg-time.h"
 
 struct AVCodecContext;
 struct AVFormatContext;
 struct AVFrame;
+struct AVIOContext;
 struct AVPacket;
 struct SwsContext;
 
 namespace timg {
-struct DisplayOptions;
+class EventLoop;
+class FileContent;
+class PipeBuffer;
 
 // Video loader, meant for one video to load, and if successful, Play().
 class VideoLoader {
 public:
-    VideoLoader();
+    // If "rewind_buffer_bytes" is non-zero, up to that many bytes of the most
+    // recently shown frames are kept in encoded form to allow stepping back.
+    explicit VideoLoader(size_t rewind_buffer_bytes = 0);
     ~VideoLoader();
 
     static const char *VersionInfo();
@@ -46,24 +56,83 @@ public:
 
     // Play video up to given duration.
     //
-    // The reference to the "interrupt_received" can be updated by a signal
-    // while the method is running and shall be checked often.
+    // Frame timing, interrupts and user interaction (pause, step, seek)
+    // are handled by the "event_loop".
     void Play(Duration duration,
-              const volatile sig_atomic_t &interrupt_received,
+              timg::EventLoop *event_loop,
               timg::TerminalCanvas *canvas);
 
+    // Make Play() only send the character cells that changed, and hold
+    // back changes of up to "threshold" in a color channel for up to about a
+    // second, which removes the flicker of compression noise in otherwise
+    // static areas. Zero: send every frame in full. Call after
+    // LoadAndScale().
+    void SetHysteresis(int threshold);
+
+    // Decode and scale the next frame without showing it, e.g. to compose
+    // it into a larger picture. Returns the framebuffer holding the frame,
+    // owned by the loader and overwritten with the next call; nullptr at
+    // end of stream.
+    const timg::Framebuffer *DecodeScaledFrame();
+
+    // Nominal time between two frames.
+    Duration frame_duration() const { return frame_duration_; }
+
 private:
+    // Set up scaling of the video to fit in the given screen size. Can be
+    // called again to re-layout for a new size.
+    bool SetupScaling(int screen_width, int screen_height);
+
     void CopyToFramebuffer(const AVFrame *av_frame);
     bool DecodePacket(AVPacket *packet, AVFrame *output_frame);
 
+    // Read packets until the next video frame is decoded into "frame".
+    // Returns false at end of stream.
+    bool DecodeNextFrame(AVPacket *packet, AVFrame *frame);
+
+    // Seek to the frame at (or just after) "position" and decode it into
+    // "frame". Returns false if the stream is not seekable.
+    bool SeekTo(int64_t position_ns, AVPacket *packet, AVFrame *frame);
+
+    // Scale decoded frame into terminal_fb_.
+    void ScaleFrame(const AVFrame *decoded);
+
+    // Scale decoded frame and send it to the canvas, recording it in the
+    // rewind buffer if enabled.
+    void ShowFrame(const AVFrame *decoded, timg::TerminalCanvas *canvas);
+
+    // Presentation time of decoded frame.
+    Duration FramePresentationTime(const AVFrame *av_frame) const;
+
+    // Callbacks of io_context_.
+    static int ReadInput(void *loader, uint8_t *buf, int size);
+    static int64_t SeekInput(void *loader, int64_t offset, int whence);
+
     int video_stream_index_ = -1;
     AVFormatContext *format_context_ = nullptr;
     AVCodecContext *codec_context_ = nullptr;
     AVFrame *output_frame_ = nullptr;
     SwsContext *sws_context_ = nullptr;
+    DisplayOptions options_;
     timg::Duration frame_duration_;  // 1/fps
     timg::Framebuffer *terminal_fb_ = nullptr;
     int center_indentation_ = 0;
+    RewindBuffer rewind_;
+    std::unique_ptr<TemporalFilter> filter_;  // If hysteresis is set.
+    bool is_first_frame_ = true;
+    Duration last_pts_;   // Presentation time of last decoded frame.
+
+    // Our own input instead of letting libav open the file: either
+    // mapped/in memory, or buffered from a pipe.
+    std::shared_ptr<const FileContent> input_;
+    int64_t input_pos_ = 0;
+    int64_t advised_until_ = 0;  // Kernel asked to read ahead until here.
+    std::unique_ptr<PipeBuffer> pipe_;
+    AVIOContext *io_context_ = nullptr;
+
+    // Used by DecodeScaledFrame(), allocated on first use.
+    AVPacket *packet_ = nullptr;
+    AVFrame *decode_frame_ = nullptr;
 };
 
 }  // namespace timg
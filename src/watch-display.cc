@@ -0,0 +1,196 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+
+#include "watch-display.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include "event-loop.h"
+#include "file-watcher.h"
+#include "image-display.h"
+#include "terminal-canvas.h"
+
+namespace timg {
+// Files are often written in several steps; only decode once no further
+// change arrived for this long.
+static constexpr Duration kSettleTime = Duration::Millis(100);
+
+namespace {
+struct WatchedImage {
+    const char *filename;
+    std::unique_ptr<Framebuffer> shown;  // nullptr if it couldn't be loaded.
+    bool changed;
+};
+
+// Everything needed to decode and place the images.
+struct Layout {
+    int width, height;
+    const DisplayOptions *options;
+    const char *bg_color;
+    const char *pattern_color;
+    bool show_filename;
+};
+}  // namespace
+
+// First frame of "filename" laid out for "layout", or nullptr if it can't
+// be loaded (e.g. it is just being written).
+static std::unique_ptr<Framebuffer> LoadForLayout(const char *filename,
+                                                  const Layout &layout) {
+    return LoadFirstFrame(filename, layout.width, layout.height,
+                          *layout.options,
+                          layout.bg_color, layout.pattern_color);
+}
+
+static int Indentation(const Framebuffer &fb, const Layout &layout) {
+    return layout.options->center_horizontally
+        ? (layout.width - fb.width()) / 2
+        : 0;
+}
+
+// Number of lines "image" occupies on the terminal.
+static int TextLines(const WatchedImage &image, const Layout &layout) {
+    return (layout.show_filename ? 1 : 0)
+        + (image.shown ? (image.shown->height() + 1) / 2 : 0);
+}
+
+static void ShowAll(const std::vector<WatchedImage> &images,
+                    const Layout &layout, TerminalCanvas *canvas) {
+    for (const WatchedImage &image : images) {
+        if (layout.show_filename) {
+            const std::string title = std::string(image.filename) + "\n";
+            canvas->SendEncoded(title.data(), title.size());
+        }
+        if (image.shown) {
+            canvas->Send(*image.shown, Indentation(*image.shown, layout));
+        }
+    }
+}
+
+// Decode the changed images again and update them on screen. The cursor
+// is expected below the last image and left there.
+static void UpdateChanged(std::vector<WatchedImage> *images,
+                          const Layout &layout, TerminalCanvas *canvas) {
+    bool needs_full_redraw = false;
+    int lines_below = 0;  // Between the image we look at and the cursor.
+    for (int i = images->size() - 1; i >= 0; --i) {
+        WatchedImage &image = (*images)[i];
+        const int lines = TextLines(image, layout);
+        if (!image.changed) {
+            lines_below += lines;
+            continue;
+        }
+        image.changed = false;
+        std::unique_ptr<Framebuffer> update = LoadForLayout(image.filename,
+                                                            layout);
+        if (!update) {
+            lines_below += lines;
+            continue;   // Keep showing what we had.
+        }
+        const int image_lines = (update->height() + 1) / 2;
+        if (!image.shown || image.shown->width() != update->width() ||
+            image.shown->height() != update->height() ||
+            lines_below + image_lines > layout.height / 2) {
+            // Layout changes or we can't reach it anymore on the screen.
+            needs_full_redraw = true;
+        } else if (!needs_full_redraw) {
+            canvas->JumpUpPixels(2 * (lines_below + image_lines));
+            canvas->SendDifference(*update, *image.shown,
+                                   Indentation(*update, layout));
+            canvas->JumpDownPixels(2 * lines_below);
+        }
+        image.shown.swap(update);
+        lines_below += TextLines(image, layout);
+    }
+    if (needs_full_redraw) {
+        canvas->ClearScreen();
+        ShowAll(*images, layout, canvas);
+    }
+}
+
+bool WatchAndDisplay(const std::vector<const char *> &files,
+                     int display_width, int display_height,
+                     const DisplayOptions &options,
+                     const char *bg_color, const char *pattern_color,
+                     bool show_filename, Duration duration,
+                     EventLoop *event_loop, TerminalCanvas *canvas) {
+    Layout layout = { display_width, display_height, &options,
+                      bg_color, pattern_color, show_filename };
+    FileWatcher watcher;
+    std::vector<WatchedImage> images;
+    bool any_loaded = false;
+    for (const char *filename : files) {
+        watcher.Watch(filename);   // Indices match the images.
+        images.push_back({ filename, LoadForLayout(filename, layout),
+                           false });
+        any_loaded |= (images.back().shown != nullptr);
+    }
+    if (!any_loaded) return false;
+    ShowAll(images, layout, canvas);
+
+    if (watcher.fd() < 0 || !event_loop->WatchInput(watcher.fd()))
+        return true;  // Best we can do is to show them once.
+
+    const Time end_time = Time::Now() + duration;
+    Time settled;
+    bool pending = false;
+    bool done = false;
+    while (!done) {
+        const Time &deadline = (pending && settled < end_time)
+            ? settled : end_time;
+        switch (event_loop->WaitUntil(deadline)) {
+        case EventLoop::Event::kInterrupt:
+            done = true;
+            break;
+        case EventLoop::Event::kKey:
+            done = (event_loop->key() == 'q');
+            break;
+        case EventLoop::Event::kResize:
+            layout.width = event_loop->terminal_pixel_width();
+            layout.height = event_loop->terminal_pixel_height();
+            for (WatchedImage &image : images) {
+                image.shown = LoadForLayout(image.filename, layout);
+                image.changed = false;
+            }
+            pending = false;
+            canvas->ClearScreen();
+            ShowAll(images, layout, canvas);
+            break;
+        case EventLoop::Event::kInput:
+            if (event_loop->input_fd() != watcher.fd()) break;
+            for (int index : watcher.ReadChanges()) {
+                images[index].changed = true;
+                pending = true;
+            }
+            settled = Time::Now() + kSettleTime;
+            break;
+        case EventLoop::Event::kDeadline:
+            if (!(Time::Now() < end_time)) {
+                done = true;
+            } else if (pending) {
+                pending = false;
+                UpdateChanged(&images, layout, canvas);
+            }
+            break;
+        case EventLoop::Event::kWakeup:
+            break;
+        }
+    }
+    event_loop->UnwatchInput(watcher.fd());
+    return true;
+}
+}  // namespace timg
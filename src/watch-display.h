@@ -0,0 +1,47 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+
+#ifndef WATCH_DISPLAY_H_
+#define WATCH_DISPLAY_H_
+
+#include <vector>
+
+#include "timg-time.h"
+
+namespace timg {
+struct DisplayOptions;
+class EventLoop;
+class TerminalCanvas;
+
+// Show "files" one below the other and keep them updated while they
+// change on disk, e.g. charts regenerated by some monitoring job.
+// When a file has been written or replaced, it is decoded again once
+// writes settled, and only the character cells that differ from what is
+// shown are sent, in place. If the size changed or the image is scrolled
+// out of view, everything is redrawn. Animations only show their first
+// frame.
+// Runs until "duration" passed or interrupted.
+// "bg_color" and "pattern_color" as in ImageLoader::LoadAndScale().
+// Returns false if none of the files could be loaded.
+bool WatchAndDisplay(const std::vector<const char *> &files,
+                     int display_width, int display_height,
+                     const DisplayOptions &options,
+                     const char *bg_color, const char *pattern_color,
+                     bool show_filename, Duration duration,
+                     EventLoop *event_loop, TerminalCanvas *canvas);
+}  // namespace timg
+
+#endif  // WATCH_DISPLAY_H_
@@ -0,0 +1,149 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "zoom-viewer.h"
+
+#include "event-loop.h"
+#include "image-display.h"
+#include "image-pyramid.h"
+#include "timg-time.h"
+
+#include <algorithm>
+#include <memory>
+#include <Magick++.h>
+
+namespace timg {
+static constexpr double kZoomStep = 1.5;      // Factor per key press.
+static constexpr double kMaxMagnification = 8.0;
+static constexpr double kPanFraction = 0.25;  // of the visible area.
+
+ZoomViewer::ZoomViewer() {}
+ZoomViewer::~ZoomViewer() { delete pyramid_; }
+
+bool ZoomViewer::Load(const char *filename, ThreadPool *pool) {
+    Magick::Image img;
+    try {
+        img.read(filename);
+    }
+    catch(Magick::Warning &warning) {
+        // Ignore, we might still have gotten an image.
+    }
+    catch (std::exception& e) {
+        return false;
+    }
+    if (img.columns() == 0 || img.rows() == 0) return false;
+
+    Framebuffer *full = new Framebuffer(img.columns(), img.rows());
+    CopyToFramebuffer(img, full);
+    pyramid_ = new ImagePyramid(full, pool);
+    return true;
+}
+
+void ZoomViewer::Run(int display_width, int display_height,
+                     EventLoop *event_loop, TerminalCanvas *canvas) {
+    const double img_width = pyramid_->width();
+    const double img_height = pyramid_->height();
+    std::unique_ptr<Framebuffer> out;
+    double fit_scale = 1.0;
+    double scale = 1.0;   // Image pixels per output pixel.
+    double center_x = img_width / 2;
+    double center_y = img_height / 2;
+    bool needs_layout = true;
+    int last_height = -1;
+
+    for (;;) {
+        if (needs_layout) {
+            out.reset(new Framebuffer(display_width, display_height));
+            fit_scale = std::max(img_width / display_width,
+                                 img_height / display_height);
+            scale = fit_scale;
+            center_x = img_width / 2;
+            center_y = img_height / 2;
+            needs_layout = false;
+        }
+
+        // Don't allow to pan further than the image edge if it is larger
+        // than the output, otherwise keep it centered.
+        const double view_width = display_width * scale;
+        const double view_height = display_height * scale;
+        if (view_width >= img_width) {
+            center_x = img_width / 2;
+        } else {
+            center_x = std::max(view_width / 2,
+                                std::min(center_x, img_width - view_width/2));
+        }
+        if (view_height >= img_height) {
+            center_y = img_height / 2;
+        } else {
+            center_y = std::max(view_height / 2,
+                                std::min(center_y,
+                                         img_height - view_height/2));
+        }
+
+        pyramid_->Render(center_x - view_width / 2,
+                         center_y - view_height / 2,
+                         scale, out.get());
+        if (last_height > 0) canvas->JumpUpPixels(last_height);
+        canvas->Send(*out, 0);
+        last_height = out->height();
+
+        if (!event_loop->interactive()) return;
+
+        bool handled = false;
+        while (!handled) {
+            const EventLoop::Event event = event_loop->WaitUntil(
+                Time::Now() + Duration::InfiniteFuture());
+            if (event == EventLoop::Event::kInterrupt) return;
+            if (event == EventLoop::Event::kResize) {
+                display_width = event_loop->terminal_pixel_width();
+                display_height = event_loop->terminal_pixel_height();
+                canvas->ClearScreen();
+                last_height = -1;
+                needs_layout = true;
+                break;
+            }
+            if (event != EventLoop::Event::kKey) continue;
+            handled = true;
+            switch (event_loop->key()) {
+            case '+': case '=':
+                scale = std::max(scale / kZoomStep, 1.0 / kMaxMagnification);
+                break;
+            case '-':
+                scale = std::min(scale * kZoomStep, fit_scale);
+                break;
+            case '0': case EventLoop::kKeyHome:
+                scale = fit_scale;
+                break;
+            case 'h': case EventLoop::kKeyLeft:
+                center_x -= kPanFraction * view_width;
+                break;
+            case 'l': case EventLoop::kKeyRight:
+                center_x += kPanFraction * view_width;
+                break;
+            case 'k': case EventLoop::kKeyUp:
+                center_y -= kPanFraction * view_height;
+                break;
+            case 'j': case EventLoop::kKeyDown:
+                center_y += kPanFraction * view_height;
+                break;
+            case 'q':
+                return;
+            default:
+                handled = false;  // Nothing changed, nothing to render.
+            }
+        }
+    }
+}
+}  // namespace timg
@@ -0,0 +1,52 @@
+// -*- mode: c++; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+// (c) 2020 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef ZOOM_VIEWER_H_
+#define ZOOM_VIEWER_H_
+
+#include "terminal-canvas.h"
+
+namespace timg {
+class EventLoop;
+class ImagePyramid;
+class ThreadPool;
+
+// Interactive viewer to zoom into and pan around large images such as maps,
+// diagrams or screenshots. On load, a mipmap pyramid of the full resolution
+// image is built, so that each view is quickly rendered from the level
+// closest to the output resolution.
+class ZoomViewer {
+public:
+    ZoomViewer();
+    ZoomViewer(const ZoomViewer &) = delete;
+    ~ZoomViewer();
+
+    // Load image from filename and build the pyramid, using the threads of
+    // "pool". Returns false if this is not a loadable image.
+    bool Load(const char *filename, ThreadPool *pool);
+
+    // Show the image in "display_width"x"display_height", initially fit to
+    // the display. Keys '+' and '-' zoom, cursor keys or h/j/k/l pan and
+    // '0' returns to fit. Returns when the user quits with 'q' or if there
+    // is no keyboard input available.
+    void Run(int display_width, int display_height,
+             EventLoop *event_loop, TerminalCanvas *canvas);
+
+private:
+    ImagePyramid *pyramid_ = nullptr;
+};
+}  // namespace timg
+
+#endif  // ZOOM_VIEWER_H_